@@ -0,0 +1,384 @@
+#include <string.h>
+#include "os/os.h"
+#include "syscfg/syscfg.h"
+#include "sysflash/sysflash.h"
+#include "flash_map/flash_map.h"
+#include "fcb/fcb.h"
+#include "host/ble_hs.h"
+#include "thermocam.h"
+
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+
+#if MYNEWT_VAL(THERMOCAM_BACKLOG_FLASH_AREA) < 0
+#error "THERMOCAM_BACKLOG needs a dedicated flash area, set THERMOCAM_BACKLOG_FLASH_AREA"
+#endif
+
+// Frames captured while no peer is connected are kept in a flash circular
+// buffer, one FCB entry per frame in THERMOCAM_FMT_PACKED. When full, the
+// oldest sector is dropped.
+//
+// A peer subscribing to the backlog characteristic receives the stored
+// frames as a byte stream, cut into notifications of ATT MTU - 3 bytes
+// regardless of frame boundaries. The stream starts at a frame boundary and
+// is terminated by an empty notification, after which the buffer is erased.
+// Sectors are freed as soon as all their frames are sent, so a drain that
+// is interrupted by a disconnect resumes where it stopped.
+//
+// Everything but thermocam_backlog_subscribe() runs on the camera task.
+
+#define BACKLOG_FCB_MAGIC       0x6b6c6274 /* "tblk" */
+#define BACKLOG_FCB_VERSION     1
+
+// Notifications sent per run of the drain callout, before live frames get
+// their turn on the camera task.
+#define BACKLOG_CHUNKS_PER_RUN  4
+
+// Free mbufs left to live notifications and the host.
+#define BACKLOG_MBUF_RESERVE    4
+
+#define BACKLOG_RETRY_TICKS     (OS_TICKS_PER_SEC / 100 + 1)
+
+static struct fcb backlog_fcb;
+static struct flash_area backlog_sectors[MYNEWT_VAL(THERMOCAM_BACKLOG_MAX_SECTORS)];
+static bool backlog_ready;
+static uint8_t backlog_decimation_cnt;
+
+// Frames stored and not sent yet.
+static uint32_t backlog_pending;
+
+// The drain position: the entry at backlog_loc is loaded into
+// backlog_record, of which backlog_record_off bytes are sent. No entry is
+// loaded while backlog_loc.fe_area is NULL.
+static struct fcb_entry backlog_loc;
+static uint8_t backlog_record[THERMOCAM_PACKED_FRAME_LEN];
+static uint16_t backlog_record_off;
+
+static struct os_callout backlog_drain_timer;
+static volatile uint16_t backlog_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static volatile bool backlog_restart;
+
+static int count_entry(struct fcb_entry *loc, void *arg)
+{
+    // entries of another size aren't ours, load_next() skips them too
+    if(loc->fe_data_len == THERMOCAM_PACKED_FRAME_LEN) {
+        (*(uint32_t *)arg)++;
+    }
+    return 0;
+}
+
+static uint32_t count_entries(struct flash_area *sector)
+{
+    uint32_t count = 0;
+
+    fcb_walk(&backlog_fcb, sector, count_entry, &count);
+    return count;
+}
+
+static void reset_position(void)
+{
+    memset(&backlog_loc, 0, sizeof backlog_loc);
+    backlog_record_off = 0;
+}
+
+/**
+ * Stores a frame captured while no peer is connected. Only every
+ * THERMOCAM_BACKLOG_DECIMATION-th frame is kept.
+ */
+void thermocam_backlog_store(const struct thermocam_frame *frame)
+{
+    uint8_t packed[THERMOCAM_PACKED_FRAME_LEN];
+    struct fcb_entry loc;
+    uint32_t left;
+    int rc;
+
+    if(!backlog_ready) {
+        return;
+    }
+    if(++backlog_decimation_cnt < MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION)) {
+        return;
+    }
+    backlog_decimation_cnt = 0;
+
+    thermocam_frame_pack(frame, packed);
+
+    rc = fcb_append(&backlog_fcb, sizeof packed, &loc);
+    if(rc == FCB_ERR_NOSPACE) {
+        // Full: drop the oldest sector. The drain position is either in
+        // it or not set, sent sectors are freed right away, so the frames
+        // left are all unsent. Frames of the sector that were sent already
+        // aren't counted as dropped.
+        rc = fcb_rotate(&backlog_fcb);
+        if(rc == 0) {
+            reset_position();
+            left = count_entries(NULL);
+            if(backlog_pending > left) {
+                STATS_INCN(thermocam_stats, backlog_dropped, backlog_pending - left);
+            }
+            backlog_pending = left;
+            rc = fcb_append(&backlog_fcb, sizeof packed, &loc);
+        }
+    }
+    if(rc == 0) {
+        rc = flash_area_write(loc.fe_area, loc.fe_data_off, packed, sizeof packed);
+    }
+    if(rc == 0) {
+        rc = fcb_append_finish(&backlog_fcb, &loc);
+    }
+    if(rc != 0) {
+        STATS_INC(thermocam_stats, backlog_flash_errors);
+        THERMOCAM_LOG(ERROR, "backlog write error %d\n", rc);
+        return;
+    }
+
+    backlog_pending++;
+    STATS_INC(thermocam_stats, backlog_stored);
+}
+
+/**
+ * Moves to the next stored frame after loc and loads it into
+ * backlog_record.
+ *
+ * @return                      0 on success, FCB_ERR_NOVAR if there are no
+ *                                  more frames, an FCB or flash error
+ *                                  otherwise.
+ */
+static int load_next(struct fcb_entry *loc)
+{
+    int rc;
+
+    do {
+        rc = fcb_getnext(&backlog_fcb, loc);
+        if(rc != 0) {
+            return rc;
+        }
+        // entries of another size aren't ours, skip them
+    } while(loc->fe_data_len != THERMOCAM_PACKED_FRAME_LEN);
+
+    return flash_area_read(loc->fe_area, loc->fe_data_off, backlog_record,
+                           THERMOCAM_PACKED_FRAME_LEN);
+}
+
+/**
+ * Sends the next MTU sized part of the backlog stream. The drain position
+ * only advances if the notification is accepted by the stack.
+ *
+ * @return                      0 if a chunk was sent, FCB_ERR_NOVAR if the
+ *                                  end of the stream was, BLE_HS_ENOMEM if
+ *                                  out of buffers, another error otherwise.
+ */
+static int send_chunk(uint16_t conn_handle)
+{
+    struct fcb_entry loc = backlog_loc;
+    struct fcb_entry last;
+    uint16_t off = backlog_record_off;
+    uint32_t completed = 0;
+    bool end = false;
+    struct os_mbuf *om;
+    uint16_t room;
+    uint16_t n;
+    int rc = 0;
+
+    room = ble_att_mtu(conn_handle);
+    if(room <= 3) {
+        return BLE_HS_ENOTCONN;
+    }
+    room -= 3;
+
+    if(os_msys_num_free() < BACKLOG_MBUF_RESERVE) {
+        return BLE_HS_ENOMEM;
+    }
+    om = ble_hs_mbuf_att_pkt();
+    if(om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    while(OS_MBUF_PKTLEN(om) < room) {
+        if(loc.fe_area == NULL || off == THERMOCAM_PACKED_FRAME_LEN) {
+            last = loc;
+            rc = load_next(&loc);
+            if(rc == FCB_ERR_NOVAR) {
+                // fcb_getnext leaves loc past the last entry
+                loc = last;
+                end = true;
+                rc = 0;
+                break;
+            }
+            if(rc != 0) {
+                break;
+            }
+            off = 0;
+        }
+        n = THERMOCAM_PACKED_FRAME_LEN - off;
+        if(n > room - OS_MBUF_PKTLEN(om)) {
+            n = room - OS_MBUF_PKTLEN(om);
+        }
+        rc = os_mbuf_append(om, backlog_record + off, n);
+        if(rc != 0) {
+            rc = BLE_HS_ENOMEM;
+            break;
+        }
+        off += n;
+        if(off == THERMOCAM_PACKED_FRAME_LEN) {
+            completed++;
+        }
+    }
+
+    if(rc == 0 && end && OS_MBUF_PKTLEN(om) > 0) {
+        // the terminating empty notification goes out next time
+        end = false;
+    }
+    if(rc == 0) {
+        // consumes om, also on failure
+        rc = ble_gattc_notify_custom(conn_handle, gatt_svr_chr_thermo_backlog_handle, om);
+        om = NULL;
+    }
+    os_mbuf_free_chain(om);
+
+    if(rc != 0) {
+        // backlog_record may hold a later frame now, reload the one at the
+        // drain position
+        if(backlog_loc.fe_area != NULL &&
+           (loc.fe_area != backlog_loc.fe_area || loc.fe_elem_off != backlog_loc.fe_elem_off)) {
+            flash_area_read(backlog_loc.fe_area, backlog_loc.fe_data_off, backlog_record,
+                            THERMOCAM_PACKED_FRAME_LEN);
+        }
+        return rc;
+    }
+
+    backlog_loc = loc;
+    backlog_record_off = off;
+    backlog_pending -= completed;
+    STATS_INCN(thermocam_stats, backlog_sent, completed);
+
+    // free the sectors behind the drain position
+    while(backlog_loc.fe_area != NULL && backlog_loc.fe_area != backlog_fcb.f_oldest) {
+        if(fcb_rotate(&backlog_fcb) != 0) {
+            break;
+        }
+    }
+
+    return end ? FCB_ERR_NOVAR : 0;
+}
+
+static void backlog_drain_cb(struct os_event *ev)
+{
+    uint16_t conn_handle = backlog_conn_handle;
+    int rc;
+    int i;
+
+    if(conn_handle == BLE_HS_CONN_HANDLE_NONE) {
+        return;
+    }
+    if(backlog_restart) {
+        // a new subscriber must not get the tail of a partly sent frame
+        backlog_restart = false;
+        if(backlog_record_off < THERMOCAM_PACKED_FRAME_LEN) {
+            backlog_record_off = 0;
+        }
+    }
+
+    for(i = 0; i < BACKLOG_CHUNKS_PER_RUN; ++i) {
+        rc = send_chunk(conn_handle);
+        if(rc == BLE_HS_ENOMEM) {
+            os_callout_reset(&backlog_drain_timer, BACKLOG_RETRY_TICKS);
+            return;
+        }
+        if(rc == FCB_ERR_NOVAR) {
+            THERMOCAM_LOG(INFO, "backlog sent; conn_handle=%d\n", conn_handle);
+            if(!fcb_is_empty(&backlog_fcb)) {
+                fcb_clear(&backlog_fcb);
+            }
+            reset_position();
+            backlog_pending = 0;
+            return;
+        }
+        if(rc != 0) {
+            if(rc != BLE_HS_ENOTCONN) {
+                STATS_INC(thermocam_stats, backlog_flash_errors);
+                THERMOCAM_LOG(ERROR, "backlog drain error %d\n", rc);
+            }
+            return;
+        }
+    }
+
+    // more to send, after the live frames that are due
+    os_callout_reset(&backlog_drain_timer, 0);
+}
+
+/**
+ * Starts or stops sending the backlog to a peer. Called on subscribe events
+ * of the backlog characteristic and on disconnect, from the host task.
+ */
+void thermocam_backlog_subscribe(uint16_t conn_handle, bool notify)
+{
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    if(notify) {
+        backlog_conn_handle = conn_handle;
+        backlog_restart = true;
+    } else if(backlog_conn_handle == conn_handle) {
+        backlog_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if(notify) {
+        os_callout_reset(&backlog_drain_timer, 0);
+    }
+}
+
+uint32_t thermocam_backlog_pending(void)
+{
+    return backlog_pending;
+}
+
+/**
+ * Sets up the flash circular buffer, keeping the frames stored before a
+ * reboot.
+ *
+ * @param evq                   The camera task's event queue.
+ */
+void thermocam_backlog_init(struct os_eventq *evq)
+{
+    int cnt = 0;
+    int rc;
+    int i;
+
+    os_callout_init(&backlog_drain_timer, evq, backlog_drain_cb, NULL);
+
+    // with a single sector, dropping the oldest one when full would erase
+    // the whole backlog
+    rc = flash_area_to_sectors(MYNEWT_VAL(THERMOCAM_BACKLOG_FLASH_AREA), &cnt, NULL);
+    if(rc != 0 || cnt < 2 || cnt > MYNEWT_VAL(THERMOCAM_BACKLOG_MAX_SECTORS)) {
+        THERMOCAM_LOG(ERROR, "backlog flash area unusable; rc=%d sectors=%d\n", rc, cnt);
+        return;
+    }
+    flash_area_to_sectors(MYNEWT_VAL(THERMOCAM_BACKLOG_FLASH_AREA), &cnt, backlog_sectors);
+
+    backlog_fcb.f_magic = BACKLOG_FCB_MAGIC;
+    backlog_fcb.f_version = BACKLOG_FCB_VERSION;
+    backlog_fcb.f_sector_cnt = cnt;
+    backlog_fcb.f_scratch_cnt = 0;
+    backlog_fcb.f_sectors = backlog_sectors;
+
+    rc = fcb_init(&backlog_fcb);
+    if(rc != 0) {
+        // not an FCB of ours, e.g. left over from an image swap
+        for(i = 0; i < cnt; ++i) {
+            flash_area_erase(&backlog_sectors[i], 0, backlog_sectors[i].fa_size);
+        }
+        rc = fcb_init(&backlog_fcb);
+    }
+    if(rc != 0) {
+        THERMOCAM_LOG(ERROR, "backlog init error %d\n", rc);
+        return;
+    }
+
+    reset_position();
+    backlog_pending = count_entries(NULL);
+    backlog_ready = true;
+    THERMOCAM_LOG(INFO, "Backlog init; sectors=%d pending=%lu\n", cnt,
+                  (unsigned long)backlog_pending);
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "host/ble_hs.h"
 #include "host/util/util.h"
 #include "services/gap/ble_svc_gap.h"
+#include "syscfg/syscfg.h"
 
 #include "thermocam.h"
 
@@ -48,6 +49,11 @@ static void advertise(void)
     const char *name;
     int rc;
 
+    // still advertising for more peers
+    if (ble_gap_adv_active()) {
+        return;
+    }
+
     /* Figure out address to use while advertising (no privacy for now) */
     rc = ble_hs_id_infer_auto(0, &own_addr_type);
     if (rc != 0) {
@@ -140,8 +146,10 @@ static int handle_gap_event(struct ble_gap_event *event, void *arg)
         }
         THERMOCAM_LOG(INFO, "\n");
 
-        if (event->connect.status != 0) {
-            /* Connection failed; resume advertising. */
+        if (event->connect.status != 0 ||
+            number_of_connections < MYNEWT_VAL(BLE_MAX_CONNECTIONS)) {
+            /* Connection failed, or there is room for another peer (e.g. a
+             * display and a gateway); resume advertising. */
             advertise();
         }
         return 0;
@@ -152,8 +160,9 @@ static int handle_gap_event(struct ble_gap_event *event, void *arg)
         THERMOCAM_LOG(INFO, "\n");
         number_of_connections--;
 
-        // make sure the connection is cleared, and we don't send more notifications
-        gatt_svr_set_peer_to_notify(BLE_HS_CONN_HANDLE_NONE);
+        // make sure we don't send more notifications to this peer, the
+        // others stay subscribed
+        gatt_svr_conn_closed(event->disconnect.conn.conn_handle);
 
         /* Connection terminated; resume advertising. */
         advertise();
@@ -163,6 +172,7 @@ static int handle_gap_event(struct ble_gap_event *event, void *arg)
         /* The central has updated the connection parameters. */
         THERMOCAM_LOG(INFO, "connection updated; status=%d ",
                             event->conn_update.status);
+        STATS_INC(thermocam_stats, conn_param_updates);
         rc = ble_gap_conn_find(event->connect.conn_handle, &desc);
         assert(rc == 0);
         print_conn_desc(&desc);
@@ -197,8 +207,13 @@ static int handle_gap_event(struct ble_gap_event *event, void *arg)
                     event->subscribe.cur_indicate);
         
         if(event->subscribe.attr_handle == gatt_svr_chr_thermo_img_handle) {
-            gatt_svr_set_peer_to_notify(event->subscribe.cur_notify ? event->subscribe.conn_handle : BLE_HS_CONN_HANDLE_NONE);
+            gatt_svr_subscribe(event->subscribe.conn_handle, event->subscribe.cur_notify);
+        }
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+        if(event->subscribe.attr_handle == gatt_svr_chr_thermo_backlog_handle) {
+            thermocam_backlog_subscribe(event->subscribe.conn_handle, event->subscribe.cur_notify);
         }
+#endif
 
         return 0;
 
@@ -1,77 +1,355 @@
+#include <stdlib.h>
+#include <string.h>
 #include "os/os.h"
+#include "syscfg/syscfg.h"
 #include "bsp/bsp.h"
 #include "hal/hal_gpio.h"
 #include "hal/hal_i2c.h"
+#include "os/os_cputime.h"
 #include "thermocam.h"
 
-uint8_t thermocam_raw_image[128];
-uint32_t thermocam_frame_cnt;
+struct thermocam_frame thermocam_last_frame;
 
 #define CAM_TASK_PRIO        (200)  /* 1 = highest, 255 = lowest */
 #define CAM_STACK_SIZE       OS_STACK_ALIGN(1024)
 static struct os_task camera_task;
 static os_stack_t camera_task_stack[CAM_STACK_SIZE];
 
-static void camera_task_func(void *arg)
+#define CAM_I2C_ADDR         (0x69)
+#define CAM_REG_FPSC         (0x02) /* frame rate register, 0 = 10 fps, 1 = 1 fps */
+#define CAM_REG_AVE          (0x07) /* average register, bit 5 = moving average */
+#define CAM_REG_AVE_UNLOCK   (0x1F) /* write sequence enabling access to AVE */
+#define CAM_REG_T01L         (0x80) /* first pixel register */
+
+// The sensor refreshes its pixel registers every 100ms or 1s, depending on
+// the configured frame rate.
+static uint32_t frame_period_ms = 100;
+
+// Serializes sensor access between the camera task and shell benchmarks.
+static struct os_mutex camera_i2c_lock;
+
+static struct os_event camera_reconfig_ev;
+static bool camera_reconfig_persist;
+static uint8_t notify_decimation_cnt;
+
+// Change gating: a frame is only notified if a pixel moved more than the
+// configured threshold since the last notified frame, or the keepalive
+// period elapsed.
+static int16_t last_notified_pixels[64];
+static os_time_t last_notify_ts;
+static volatile bool notify_forced = true;
+
+// Acquisition is driven by a callout on the camera task's own event queue.
+// Deadlines are calculated from the absolute frame index instead of
+// re-arming the timer with a relative delay after each read, so neither the
+// I2C transaction time nor the rounding of 100ms to whole os ticks adds up.
+static struct os_eventq camera_evq;
+static struct os_callout camera_timer;
+static os_time_t camera_timer_start;
+static uint32_t camera_timer_idx;
+
+static os_time_t frame_deadline(uint32_t idx)
 {
-    THERMOCAM_LOG(INFO, "Camera task started\n");
+    return camera_timer_start +
+        (os_time_t)(((uint64_t)idx * frame_period_ms * OS_TICKS_PER_SEC) / 1000);
+}
+
+static void schedule_next_frame(void)
+{
+    os_time_t now = os_time_get();
+    os_time_t deadline;
+
+    // if a frame took longer than the period, skip the missed slots
+    // instead of bursting to catch up
+    do {
+        camera_timer_idx++;
+        deadline = frame_deadline(camera_timer_idx);
+    } while (!OS_TIME_TICK_GT(deadline, now));
 
-    int rc = 0;
-    
-    uint8_t b[2];
-    
+    os_callout_reset(&camera_timer, deadline - now);
+}
+
+static int write_reg(uint8_t reg, uint8_t val)
+{
+    int rc;
+    uint8_t b[2] = { reg, val };
     struct hal_i2c_master_data pdata;
-    pdata.address = 0x69;
-    pdata.len = 2;
+
+    pdata.address = CAM_I2C_ADDR;
+    pdata.len = sizeof b;
     pdata.buffer = b;
-    b[0]=2;
-    b[1]=0;
+    os_mutex_pend(&camera_i2c_lock, OS_WAIT_FOREVER);
     rc = hal_i2c_master_write(0, &pdata, OS_TICKS_PER_SEC, 1);
+    os_mutex_release(&camera_i2c_lock);
     if(rc != 0) {
+        STATS_INC(thermocam_stats, i2c_write_errors);
         THERMOCAM_LOG(ERROR, "I2C write error %d\n", rc);
     }
- 
-    while (1) {
-        os_time_delay(OS_TICKS_PER_SEC/10);
+    return rc;
+}
 
-        if(!has_connected_peer()) {
-            continue;
-        }
-        
-        pdata.len = 1;
-        pdata.buffer = b;
-        b[0] = 0x80;
-        rc = hal_i2c_master_write(0, &pdata, OS_TICKS_PER_SEC, 1);
-        if(rc != 0) {
-            THERMOCAM_LOG(ERROR, "I2C write error %d\n", rc);
-            continue;
-        }
-        
-        pdata.len=128;
-        pdata.buffer=thermocam_raw_image;
-        rc = hal_i2c_master_read(0, &pdata, OS_TICKS_PER_SEC, 1);
-        if(rc != 0) {
-            THERMOCAM_LOG(ERROR, "I2C read error %d\n", rc);
-            continue;
+/**
+ * Reads the 64 pixel registers of the sensor.
+ *
+ * @param pixels                Buffer of 128 bytes receiving the registers.
+ * @param usecs                 If not NULL, receives the duration of the
+ *                                  transaction.
+ * @param account               Whether the duration goes into the i2c_time
+ *                                  stats. Benchmarks read back to back,
+ *                                  and would skew the figures of the
+ *                                  periodic capture. Errors are always
+ *                                  counted.
+ *
+ * @return                      0 on success, the HAL error code otherwise.
+ */
+int thermocam_camera_read(uint8_t *pixels, uint32_t *usecs, bool account)
+{
+    int rc;
+    uint8_t reg = CAM_REG_T01L;
+    struct hal_i2c_master_data pdata;
+    uint32_t start;
+    uint32_t elapsed;
+
+    os_mutex_pend(&camera_i2c_lock, OS_WAIT_FOREVER);
+    start = os_cputime_get32();
+
+    pdata.address = CAM_I2C_ADDR;
+    pdata.len = 1;
+    pdata.buffer = &reg;
+    rc = hal_i2c_master_write(0, &pdata, OS_TICKS_PER_SEC, 1);
+    if(rc != 0) {
+        os_mutex_release(&camera_i2c_lock);
+        STATS_INC(thermocam_stats, i2c_write_errors);
+        THERMOCAM_LOG(ERROR, "I2C write error %d\n", rc);
+        return rc;
+    }
+
+    pdata.len = sizeof thermocam_last_frame.pixels;
+    pdata.buffer = pixels;
+    rc = hal_i2c_master_read(0, &pdata, OS_TICKS_PER_SEC, 1);
+    elapsed = os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+    os_mutex_release(&camera_i2c_lock);
+    if(rc != 0) {
+        STATS_INC(thermocam_stats, i2c_read_errors);
+        THERMOCAM_LOG(ERROR, "I2C read error %d\n", rc);
+        return rc;
+    }
+
+    if(account) {
+        thermocam_stats_i2c_time(elapsed);
+    }
+    if(usecs) {
+        *usecs = elapsed;
+    }
+    return 0;
+}
+
+int16_t thermocam_pixel_value(const uint8_t *p)
+{
+    // 12 bit two's complement, in 0.25 degC units
+    int16_t val = p[0] | ((p[1] & 0x0f) << 8);
+    return (val & 0x800) ? val - 0x1000 : val;
+}
+
+/**
+ * Packs a frame as in THERMOCAM_FMT_PACKED: two 12 bit pixels go into three
+ * bytes, followed by the sequence number and timestamp.
+ *
+ * @param out                   Buffer of THERMOCAM_PACKED_FRAME_LEN bytes.
+ */
+void thermocam_frame_pack(const struct thermocam_frame *frame, uint8_t *out)
+{
+    int i;
+
+    for(i = 0; i < 32; ++i) {
+        const uint8_t *p = &frame->pixels[i * 4];
+        out[i * 3] = p[0];
+        out[i * 3 + 1] = (p[1] & 0x0f) | (p[2] << 4);
+        out[i * 3 + 2] = (p[2] >> 4) | (p[3] << 4);
+    }
+    memcpy(out + 96, &frame->seq, sizeof frame->seq + sizeof frame->timestamp_ms);
+}
+
+/**
+ * Appends a frame to the mbuf in the given payload format.
+ *
+ * @param format                One of THERMOCAM_FMT_*.
+ *
+ * @return                      0 on success, the os_mbuf_append error
+ *                                  otherwise.
+ */
+int thermocam_frame_append(struct os_mbuf *om, const struct thermocam_frame *frame,
+                           uint8_t format)
+{
+    uint8_t packed[THERMOCAM_PACKED_FRAME_LEN];
+
+    if(format == THERMOCAM_FMT_RAW) {
+        return os_mbuf_append(om, frame, sizeof *frame);
+    }
+
+    thermocam_frame_pack(frame, packed);
+    return os_mbuf_append(om, packed, sizeof packed);
+}
+
+/**
+ * Decides whether the frame differs enough from the last notified one to be
+ * worth sending, and if so, remembers it as the new reference.
+ */
+static bool frame_should_notify(const struct thermocam_frame *frame, os_time_t now)
+{
+    const struct thermocam_settings *s = &thermocam_settings;
+    int16_t pixels[64];
+    bool changed = false;
+    int i;
+
+    for(i = 0; i < 64; ++i) {
+        pixels[i] = thermocam_pixel_value(&frame->pixels[i * 2]);
+        if(!changed && abs(pixels[i] - last_notified_pixels[i]) > s->change_threshold) {
+            changed = true;
         }
+    }
+
+    if(s->change_threshold != 0 && !changed && !notify_forced &&
+       now - last_notify_ts < (os_time_t)s->keepalive_s * OS_TICKS_PER_SEC) {
+        return false;
+    }
+
+    memcpy(last_notified_pixels, pixels, sizeof pixels);
+    last_notify_ts = now;
+    notify_forced = false;
+    return true;
+}
+
+static void camera_timer_cb(struct os_event *ev)
+{
+    static struct thermocam_frame frame;
+    bool connected = has_connected_peer();
+    os_sr_t sr;
+
+    schedule_next_frame();
 
-        // trigger notify of data change
-        gatt_svr_notify();
+    if(!connected && !MYNEWT_VAL(THERMOCAM_CAPTURE_ALWAYS) &&
+       !MYNEWT_VAL(THERMOCAM_BACKLOG)) {
+        return;
+    }
+
+    // timestamp the start of the transaction, the sensor latched the
+    // pixels at some point during the preceding period
+    frame.timestamp_ms = (uint32_t)(os_get_uptime_usec() / 1000);
+    if(thermocam_camera_read(frame.pixels, NULL, true) != 0) {
+        return;
+    }
+    frame.seq = thermocam_last_frame.seq + 1;
+    STATS_INC(thermocam_stats, frames_captured);
+
+    OS_ENTER_CRITICAL(sr);
+    thermocam_last_frame = frame;
+    OS_EXIT_CRITICAL(sr);
+
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+    // keep the frames for the next peer instead of losing them
+    if(!connected) {
+        thermocam_backlog_store(&frame);
+        return;
+    }
+#endif
 
-        thermocam_frame_cnt++;
-        int i;
-        for(i = 0; i < 64; ++i) {
-            //uint16_t val = ((uint16_t)b[i*2 + 1] << 8) | ((uint16_t)b[i*2]);
-            //uint16_t absVal = (val & 0x7FF);
-            //image[i] =  ((val & 0x800) ? 0 - (float)absVal : (float)absVal) / 4;
+    // trigger notify of data change, on every n-th frame only
+    if(++notify_decimation_cnt >= thermocam_settings.decimation) {
+        notify_decimation_cnt = 0;
+        if(frame_should_notify(&frame, os_time_get())) {
+            gatt_svr_notify(true);
+        } else {
+            STATS_INC(thermocam_stats, frames_gated);
         }
     }
 }
 
+/**
+ * Writes the active settings to the sensor and restarts the acquisition
+ * timer with the matching period. Runs on the camera task.
+ */
+static void apply_settings(void)
+{
+    const struct thermocam_settings *s = &thermocam_settings;
+
+    write_reg(CAM_REG_FPSC, s->fps == 1 ? 1 : 0);
+
+    write_reg(CAM_REG_AVE_UNLOCK, 0x50);
+    write_reg(CAM_REG_AVE_UNLOCK, 0x45);
+    write_reg(CAM_REG_AVE_UNLOCK, 0x57);
+    write_reg(CAM_REG_AVE, s->averaging ? 0x20 : 0x00);
+    write_reg(CAM_REG_AVE_UNLOCK, 0x00);
+
+    frame_period_ms = 1000 / s->fps;
+    notify_decimation_cnt = 0;
+    notify_forced = true;
+
+    camera_timer_start = os_time_get();
+    camera_timer_idx = 0;
+    os_callout_reset(&camera_timer, 0);
+
+    THERMOCAM_LOG(INFO, "Camera configured; fps=%d avg=%d decim=%d fmt=%d "
+                  "threshold=%d keepalive=%d\n",
+                  s->fps, s->averaging, s->decimation, s->format,
+                  s->change_threshold, s->keepalive_s);
+}
+
+static void camera_reconfig_cb(struct os_event *ev)
+{
+    apply_settings();
+
+    if(camera_reconfig_persist) {
+        camera_reconfig_persist = false;
+        thermocam_settings_save();
+    }
+}
+
+/**
+ * Makes sure the next captured frame is notified regardless of change
+ * gating, e.g. because a new peer subscribed and has no reference frame.
+ */
+void thermocam_camera_force_notify(void)
+{
+    notify_forced = true;
+}
+
+/**
+ * Asks the camera task to apply the current thermocam_settings.
+ *
+ * @param persist               Whether the settings should be saved to
+ *                                  flash once applied.
+ */
+void thermocam_camera_reconfigure(bool persist)
+{
+    if(persist) {
+        camera_reconfig_persist = true;
+    }
+    os_eventq_put(&camera_evq, &camera_reconfig_ev);
+}
+
+static void camera_task_func(void *arg)
+{
+    THERMOCAM_LOG(INFO, "Camera task started\n");
+
+    apply_settings();
+
+    while (1) {
+        os_eventq_run(&camera_evq);
+    }
+}
+
 void thermocam_camera_init(void)
 {
     THERMOCAM_LOG(INFO, "Camera task init\n");
+    os_mutex_init(&camera_i2c_lock);
+    os_eventq_init(&camera_evq);
+    os_callout_init(&camera_timer, &camera_evq, camera_timer_cb, NULL);
+    camera_reconfig_ev.ev_cb = camera_reconfig_cb;
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+    thermocam_backlog_init(&camera_evq);
+#endif
     os_task_init(&camera_task, "cam", camera_task_func, NULL,
                  CAM_TASK_PRIO, OS_WAIT_FOREVER, camera_task_stack,
                  CAM_STACK_SIZE);
-}
\ No newline at end of file
+}
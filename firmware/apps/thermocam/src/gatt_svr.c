@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "bsp/bsp.h"
+#include "syscfg/syscfg.h"
 #include "host/ble_hs.h"
 #include "host/ble_uuid.h"
 #include "thermocam.h"
@@ -16,9 +17,22 @@ static const ble_uuid128_t gatt_svr_chr_thermo_img_uuid =
         BLE_UUID128_INIT(0x53, 0x2c, 0x6e, 0x2c, 0xaf, 0x7e, 0x81, 0x8e,
                          0x32, 0x49, 0xd2, 0x9d, 0xfc, 0x6c, 0xe6, 0x52);
 
+/* 52e66cfd-9dd2-4932-8e81-7eaf2c6e2c53 */
+static const ble_uuid128_t gatt_svr_chr_thermo_settings_uuid =
+        BLE_UUID128_INIT(0x53, 0x2c, 0x6e, 0x2c, 0xaf, 0x7e, 0x81, 0x8e,
+                         0x32, 0x49, 0xd2, 0x9d, 0xfd, 0x6c, 0xe6, 0x52);
+
+/* 52e66cfe-9dd2-4932-8e81-7eaf2c6e2c53 */
+static const ble_uuid128_t gatt_svr_chr_thermo_backlog_uuid =
+        BLE_UUID128_INIT(0x53, 0x2c, 0x6e, 0x2c, 0xaf, 0x7e, 0x81, 0x8e,
+                         0x32, 0x49, 0xd2, 0x9d, 0xfe, 0x6c, 0xe6, 0x52);
 
 uint16_t gatt_svr_chr_thermo_img_handle;
-static uint16_t conn_handle_to_notify = BLE_HS_CONN_HANDLE_NONE;
+uint16_t gatt_svr_chr_thermo_backlog_handle;
+
+// Peers subscribed to notifications of the thermal image, one slot per
+// possible connection. Free slots have conn_handle BLE_HS_CONN_HANDLE_NONE.
+static struct gatt_svr_peer notify_peers[MYNEWT_VAL(BLE_MAX_CONNECTIONS)];
 
 static int
 gatt_svr_chr_access_thermo_cam(uint16_t conn_handle, uint16_t attr_handle,
@@ -37,6 +51,21 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
             .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
             .val_handle = &gatt_svr_chr_thermo_img_handle,
         }, {
+            /*** Characteristic: Camera settings. */
+            .uuid = &gatt_svr_chr_thermo_settings_uuid.u,
+            .access_cb = gatt_svr_chr_access_thermo_cam,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+        }, {
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+            /*** Characteristic: Frames stored while disconnected. Reads
+             * return the number of pending frames, subscribing streams them
+             * (see backlog.c). */
+            .uuid = &gatt_svr_chr_thermo_backlog_uuid.u,
+            .access_cb = gatt_svr_chr_access_thermo_cam,
+            .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+            .val_handle = &gatt_svr_chr_thermo_backlog_handle,
+        }, {
+#endif
             0, /* No more characteristics in this service. */
         } },
     },
@@ -46,6 +75,22 @@ static const struct ble_gatt_svc_def gatt_svr_svcs[] = {
     },
 };
 
+/**
+ * Appends the last captured frame to the mbuf, in the configured payload
+ * format.
+ */
+static int append_frame(struct os_mbuf *om)
+{
+    struct thermocam_frame frame;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    frame = thermocam_last_frame;
+    OS_EXIT_CRITICAL(sr);
+
+    return thermocam_frame_append(om, &frame, thermocam_settings.format);
+}
+
 static int gatt_svr_chr_access_thermo_cam(uint16_t conn_handle, uint16_t attr_handle,
                                           struct ble_gatt_access_ctxt *ctxt,
                                           void *arg)
@@ -62,9 +107,51 @@ static int gatt_svr_chr_access_thermo_cam(uint16_t conn_handle, uint16_t attr_ha
     if (ble_uuid_cmp(uuid, &gatt_svr_chr_thermo_img_uuid.u) == 0) {
         assert(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR);
 
-        rc = os_mbuf_append(ctxt->om, &thermocam_raw_image, sizeof thermocam_raw_image);
+        rc = append_frame(ctxt->om);
+        if (rc != 0) {
+            STATS_INC(thermocam_stats, mbuf_alloc_failed);
+            return BLE_ATT_ERR_INSUFFICIENT_RES;
+        }
+        return 0;
+    }
+
+    if (ble_uuid_cmp(uuid, &gatt_svr_chr_thermo_settings_uuid.u) == 0) {
+        struct thermocam_settings settings;
+        uint16_t len;
+
+        switch (ctxt->op) {
+        case BLE_GATT_ACCESS_OP_READ_CHR:
+            rc = os_mbuf_append(ctxt->om, &thermocam_settings, sizeof thermocam_settings);
+            return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+
+        case BLE_GATT_ACCESS_OP_WRITE_CHR:
+            if (OS_MBUF_PKTLEN(ctxt->om) != sizeof settings) {
+                return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+            }
+            rc = ble_hs_mbuf_to_flat(ctxt->om, &settings, sizeof settings, &len);
+            if (rc != 0) {
+                return BLE_ATT_ERR_UNLIKELY;
+            }
+            rc = thermocam_settings_update(&settings);
+            return rc == 0 ? 0 : BLE_ATT_ERR_VALUE_NOT_ALLOWED;
+
+        default:
+            assert(0);
+            return BLE_ATT_ERR_UNLIKELY;
+        }
+    }
+
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+    if (ble_uuid_cmp(uuid, &gatt_svr_chr_thermo_backlog_uuid.u) == 0) {
+        uint32_t pending;
+
+        assert(ctxt->op == BLE_GATT_ACCESS_OP_READ_CHR);
+
+        pending = htole32(thermocam_backlog_pending());
+        rc = os_mbuf_append(ctxt->om, &pending, sizeof pending);
         return rc == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
     }
+#endif
 
     /* Unknown characteristic; the nimble stack should not have called this
      * function.
@@ -104,34 +191,261 @@ void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg)
     }
 }
 
+static struct gatt_svr_peer *find_peer(uint16_t conn_handle)
+{
+    int i;
+
+    for (i = 0; i < MYNEWT_VAL(BLE_MAX_CONNECTIONS); ++i) {
+        if (notify_peers[i].conn_handle == conn_handle) {
+            return &notify_peers[i];
+        }
+    }
+    return NULL;
+}
+
 /**
- * This function must be called with the connection handlewhen a gap
- * connect event is received in order to send notifications to the
- * client.
+ * Adds or removes a peer from the ones notified of new frames. Called on
+ * subscribe events of the thermal image characteristic.
  *
- * @params conn_handle          The connection handle for the current
- *                                  connection.
+ * @param conn_handle           The connection of the peer.
+ * @param notify                Whether the peer enabled notifications.
  */
-void gatt_svr_set_peer_to_notify(uint16_t conn_handle)
+void gatt_svr_subscribe(uint16_t conn_handle, bool notify)
 {
-    conn_handle_to_notify = conn_handle;
+    struct gatt_svr_peer *peer;
+    os_sr_t sr;
+
+    // the camera and shell tasks take snapshots of the peers, a slot is
+    // changed as a whole
+    OS_ENTER_CRITICAL(sr);
+    peer = find_peer(conn_handle);
+    if (!notify) {
+        if (peer) {
+            peer->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+        }
+        OS_EXIT_CRITICAL(sr);
+        return;
+    }
+
+    if (!peer) {
+        peer = find_peer(BLE_HS_CONN_HANDLE_NONE);
+        if (peer) {
+            memset(peer, 0, sizeof *peer);
+            peer->conn_handle = conn_handle;
+        }
+    }
+    OS_EXIT_CRITICAL(sr);
+    if (!peer) {
+        // can't happen, there is a slot per connection
+        THERMOCAM_LOG(ERROR, "no slot for subscriber; conn_handle=%d\n", conn_handle);
+        return;
+    }
+
+    // send the current frame without waiting for it to change
+    thermocam_camera_force_notify();
+}
+
+/**
+ * Must be called when a connection is terminated, so no more notifications
+ * are sent to it.
+ */
+void gatt_svr_conn_closed(uint16_t conn_handle)
+{
+    gatt_svr_subscribe(conn_handle, false);
+#if MYNEWT_VAL(THERMOCAM_BACKLOG)
+    thermocam_backlog_subscribe(conn_handle, false);
+#endif
 }
 
 bool is_notification_enabled()
 {
-    return conn_handle_to_notify != BLE_HS_CONN_HANDLE_NONE;
+    int i;
+
+    for (i = 0; i < MYNEWT_VAL(BLE_MAX_CONNECTIONS); ++i) {
+        if (notify_peers[i].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void gatt_svr_notify()
+/**
+ * Copies the subscribed peers and their counters.
+ *
+ * @param peers                 Room for BLE_MAX_CONNECTIONS peers.
+ *
+ * @return                      The number of peers copied.
+ */
+int gatt_svr_peers(struct gatt_svr_peer *peers)
 {
-    if(is_notification_enabled()) {
-        ble_gattc_notify(conn_handle_to_notify, gatt_svr_chr_thermo_img_handle);
+    int count = 0;
+    os_sr_t sr;
+    int i;
+
+    OS_ENTER_CRITICAL(sr);
+    for (i = 0; i < MYNEWT_VAL(BLE_MAX_CONNECTIONS); ++i) {
+        if (notify_peers[i].conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+            peers[count++] = notify_peers[i];
+        }
     }
+    OS_EXIT_CRITICAL(sr);
+    return count;
+}
+
+/**
+ * Builds a notification of the last captured frame.
+ *
+ * @return                      The payload, NULL if out of buffers.
+ */
+static struct os_mbuf *frame_notification(bool account)
+{
+    struct os_mbuf *om;
+
+    om = ble_hs_mbuf_att_pkt();
+    if (om == NULL || append_frame(om) != 0) {
+        os_mbuf_free_chain(om);
+        if (account) {
+            STATS_INC(thermocam_stats, mbuf_alloc_failed);
+            STATS_INC(thermocam_stats, notify_failed);
+        }
+        return NULL;
+    }
+    return om;
+}
+
+/**
+ * Sends a notification to one peer and counts it, consuming txom. A NULL
+ * txom counts as out of buffers.
+ */
+static int send_notification(uint16_t conn_handle, struct os_mbuf *txom, bool account)
+{
+    struct gatt_svr_peer *peer;
+    os_sr_t sr;
+    int rc;
+
+    if (txom == NULL) {
+        rc = BLE_HS_ENOMEM;
+    } else {
+        // consumes txom, also on failure
+        rc = ble_gattc_notify_custom(conn_handle, gatt_svr_chr_thermo_img_handle, txom);
+    }
+    if (!account) {
+        return rc;
+    }
+
+    // the counters of a peer that left meanwhile are dropped with it
+    OS_ENTER_CRITICAL(sr);
+    peer = find_peer(conn_handle);
+    if (peer) {
+        if (rc == 0) {
+            peer->notify_sent++;
+        } else {
+            peer->notify_failed++;
+        }
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    if (rc == 0) {
+        STATS_INC(thermocam_stats, notify_sent);
+    } else {
+        STATS_INC(thermocam_stats, notify_failed);
+        if (rc == BLE_HS_ENOMEM) {
+            STATS_INC(thermocam_stats, mbuf_alloc_failed);
+        }
+    }
+    return rc;
+}
+
+/**
+ * Notifies all subscribed peers of the last captured frame. The payload is
+ * built once, every peer but the last gets a copy of the mbuf.
+ *
+ * @param account               Whether the notifications count in the
+ *                                  stats and peer counters; false for
+ *                                  benchmark bursts.
+ *
+ * @return                      0 if all peers were notified, the error of
+ *                                  the last failure otherwise.
+ */
+int gatt_svr_notify(bool account)
+{
+    uint16_t conn_handles[MYNEWT_VAL(BLE_MAX_CONNECTIONS)];
+    struct os_mbuf *om;
+    struct os_mbuf *txom;
+    int remaining = 0;
+    int result = 0;
+    os_sr_t sr;
+    int rc;
+    int i;
+
+    // peers subscribe and leave on the host task, the ones notified are
+    // the ones of the snapshot
+    OS_ENTER_CRITICAL(sr);
+    for (i = 0; i < MYNEWT_VAL(BLE_MAX_CONNECTIONS); ++i) {
+        conn_handles[i] = notify_peers[i].conn_handle;
+        if (conn_handles[i] != BLE_HS_CONN_HANDLE_NONE) {
+            remaining++;
+        }
+    }
+    OS_EXIT_CRITICAL(sr);
+    if (remaining == 0) {
+        return BLE_HS_ENOTCONN;
+    }
+
+    om = frame_notification(account);
+    if (om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+
+    for (i = 0; i < MYNEWT_VAL(BLE_MAX_CONNECTIONS); ++i) {
+        if (conn_handles[i] == BLE_HS_CONN_HANDLE_NONE) {
+            continue;
+        }
+
+        if (--remaining > 0) {
+            txom = os_mbuf_dup(om);
+        } else {
+            txom = om;
+            om = NULL;
+        }
+        rc = send_notification(conn_handles[i], txom, account);
+        if (rc != 0) {
+            result = rc;
+        }
+    }
+
+    os_mbuf_free_chain(om);
+    return result;
+}
+
+/**
+ * Notifies one peer of the last captured frame, e.g. to retry only the peer
+ * gatt_svr_notify() failed on.
+ *
+ * @param conn_handle           The peer, subscribed or not.
+ * @param account               As for gatt_svr_notify().
+ *
+ * @return                      0 on success, a BLE_HS error otherwise.
+ */
+int gatt_svr_notify_peer(uint16_t conn_handle, bool account)
+{
+    struct os_mbuf *om;
+
+    om = frame_notification(account);
+    if (om == NULL) {
+        return BLE_HS_ENOMEM;
+    }
+    return send_notification(conn_handle, om, account);
 }
 
 int thermocam_gatt_svr_init(void)
 {
     int rc;
+    int i;
+
+    for (i = 0; i < MYNEWT_VAL(BLE_MAX_CONNECTIONS); ++i) {
+        notify_peers[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+    }
 
     rc = ble_gatts_count_cfg(gatt_svr_svcs);
     if (rc != 0) {
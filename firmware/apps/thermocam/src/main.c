@@ -13,13 +13,16 @@ int main(int argc, char **argv)
     thermocam_shell_init();
  
     sysinit();
+
+    thermocam_stats_init();
+    thermocam_settings_init();
     
     thermocam_ble_init();
     thermocam_camera_init();
     thermocam_gatt_svr_init();
     thermocam_status_led_init();
 
-    //conf_load();
+    conf_load();
     
     while (1) {
         /* Run the event queue to process background events */
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <string.h>
+#include "os/os.h"
+#include "config/config.h"
+#include "thermocam.h"
+
+struct thermocam_settings thermocam_settings = {
+    .fps = 10,
+    .averaging = 0,
+    .decimation = 1,
+    .format = THERMOCAM_FMT_RAW,
+    .change_threshold = 0,
+    .keepalive_s = 5,
+};
+
+static char *settings_get(int argc, char **argv, char *val, int val_len_max);
+static int settings_set(int argc, char **argv, char *val);
+static int settings_commit(void);
+static int settings_export(void (*func)(char *name, char *val),
+                           enum conf_export_tgt tgt);
+
+static struct conf_handler settings_handler = {
+    .ch_name = "thermocam",
+    .ch_get = settings_get,
+    .ch_set = settings_set,
+    .ch_commit = settings_commit,
+    .ch_export = settings_export,
+};
+
+// values loaded from flash or set through the config cli are collected
+// here, and only take effect on commit
+static struct thermocam_settings pending_settings;
+
+static uint8_t *settings_field(struct thermocam_settings *s, const char *name)
+{
+    if (!strcmp(name, "fps")) {
+        return &s->fps;
+    } else if (!strcmp(name, "avg")) {
+        return &s->averaging;
+    } else if (!strcmp(name, "decim")) {
+        return &s->decimation;
+    } else if (!strcmp(name, "fmt")) {
+        return &s->format;
+    } else if (!strcmp(name, "thresh")) {
+        return &s->change_threshold;
+    } else if (!strcmp(name, "keepalive")) {
+        return &s->keepalive_s;
+    }
+    return NULL;
+}
+
+// The settings are unsigned bytes, the config subsystem only has signed
+// types; they are stored as CONF_INT16 so values above 127 round-trip.
+static char *field_to_str(const uint8_t *field, char *buf, int buf_len)
+{
+    int16_t value = *field;
+
+    return conf_str_from_value(CONF_INT16, &value, buf, buf_len);
+}
+
+static int field_from_str(char *val, uint8_t *field)
+{
+    int16_t value;
+    int rc;
+
+    rc = CONF_VALUE_SET(val, CONF_INT16, value);
+    if (rc != 0) {
+        return rc;
+    }
+    // values saved as CONF_INT8 by earlier versions read back negative
+    if (value >= INT8_MIN && value < 0) {
+        value += 256;
+    }
+    if (value < 0 || value > UINT8_MAX) {
+        return OS_EINVAL;
+    }
+    *field = value;
+    return 0;
+}
+
+static char *settings_get(int argc, char **argv, char *val, int val_len_max)
+{
+    uint8_t *field;
+
+    if (argc != 1) {
+        return NULL;
+    }
+    field = settings_field(&thermocam_settings, argv[0]);
+    if (!field) {
+        return NULL;
+    }
+    return field_to_str(field, val, val_len_max);
+}
+
+static int settings_set(int argc, char **argv, char *val)
+{
+    uint8_t *field;
+
+    if (argc != 1) {
+        return OS_ENOENT;
+    }
+    field = settings_field(&pending_settings, argv[0]);
+    if (!field) {
+        return OS_ENOENT;
+    }
+    return field_from_str(val, field);
+}
+
+static int settings_commit(void)
+{
+    if (!thermocam_settings_valid(&pending_settings)) {
+        THERMOCAM_LOG(ERROR, "Ignoring invalid thermocam settings\n");
+        pending_settings = thermocam_settings;
+        return OS_EINVAL;
+    }
+    thermocam_settings = pending_settings;
+    thermocam_camera_reconfigure(false);
+    return 0;
+}
+
+static int settings_export(void (*func)(char *name, char *val),
+                           enum conf_export_tgt tgt)
+{
+    char buf[4];
+
+    func("thermocam/fps",
+         field_to_str(&thermocam_settings.fps, buf, sizeof buf));
+    func("thermocam/avg",
+         field_to_str(&thermocam_settings.averaging, buf, sizeof buf));
+    func("thermocam/decim",
+         field_to_str(&thermocam_settings.decimation, buf, sizeof buf));
+    func("thermocam/fmt",
+         field_to_str(&thermocam_settings.format, buf, sizeof buf));
+    func("thermocam/thresh",
+         field_to_str(&thermocam_settings.change_threshold, buf, sizeof buf));
+    func("thermocam/keepalive",
+         field_to_str(&thermocam_settings.keepalive_s, buf, sizeof buf));
+    return 0;
+}
+
+bool thermocam_settings_valid(const struct thermocam_settings *s)
+{
+    return (s->fps == 1 || s->fps == 10) &&
+           s->averaging <= 1 &&
+           s->decimation >= 1 &&
+           s->format < THERMOCAM_FMT_COUNT &&
+           s->keepalive_s >= 1;
+}
+
+/**
+ * Replaces the active settings, and asks the camera task to apply and
+ * persist them.
+ *
+ * @return                      0 on success, OS_EINVAL if the settings are
+ *                                  out of range.
+ */
+int thermocam_settings_update(const struct thermocam_settings *s)
+{
+    if (!thermocam_settings_valid(s)) {
+        return OS_EINVAL;
+    }
+    thermocam_settings = *s;
+    pending_settings = *s;
+    thermocam_camera_reconfigure(true);
+    return 0;
+}
+
+void thermocam_settings_save(void)
+{
+    int rc = conf_save();
+    if (rc != 0) {
+        THERMOCAM_LOG(ERROR, "Failed to save settings; rc=%d\n", rc);
+    }
+}
+
+void thermocam_settings_init(void)
+{
+    int rc;
+
+    pending_settings = thermocam_settings;
+    rc = conf_register(&settings_handler);
+    assert(rc == 0);
+}
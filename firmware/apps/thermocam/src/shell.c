@@ -1,15 +1,29 @@
 
+#include <stdlib.h>
+#include <string.h>
+#include "os/os.h"
+#include "os/os_cputime.h"
+#include "host/ble_hs.h"
 #include "shell/shell.h"
 #include "console/console.h"
 
 #include "thermocam.h"
 
+#define BENCH_MAX_SAMPLES    128
+#define BENCH_DEFAULT_COUNT  50
+
+static uint32_t bench_samples[BENCH_MAX_SAMPLES];
+
 static int query_cam_fn(int argc, char **argv)
 {
     int i;
-    console_printf("framecnt: \n");
+    console_printf("framecnt: %lu ts: %lu\n",
+                   (unsigned long)thermocam_last_frame.seq,
+                   (unsigned long)thermocam_last_frame.timestamp_ms);
     for(i = 0; i < 64; ++i) {
-        console_printf("%d ", (int)(thermocam_raw_image[i]));
+        // pixel values are in 0.25 degC units
+        int val = thermocam_pixel_value(&thermocam_last_frame.pixels[i * 2]) * 25;
+        console_printf("%s%d.%02d ", val < 0 ? "-" : "", abs(val) / 100, abs(val) % 100);
         if((i+1) % 8 == 0) {
             console_printf("\n");
         }
@@ -22,8 +36,197 @@ static struct shell_cmd query_cam_cmd = {
     .sc_cmd_func = query_cam_fn
 };
 
+static int cam_peers_fn(int argc, char **argv)
+{
+    struct gatt_svr_peer peers[MYNEWT_VAL(BLE_MAX_CONNECTIONS)];
+    int count;
+    int i;
+
+    count = gatt_svr_peers(peers);
+    console_printf("%-6s %8s %8s\n", "conn", "sent", "failed");
+    for(i = 0; i < count; ++i) {
+        console_printf("%-6d %8lu %8lu\n", peers[i].conn_handle,
+                       (unsigned long)peers[i].notify_sent,
+                       (unsigned long)peers[i].notify_failed);
+    }
+    return 0;
+}
+
+static struct shell_cmd cam_peers_cmd = {
+    .sc_cmd = "cam_peers",
+    .sc_cmd_func = cam_peers_fn
+};
+
+static int cmp_u32(const void *a, const void *b)
+{
+    const uint32_t x = *(const uint32_t *)a;
+    const uint32_t y = *(const uint32_t *)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static void print_header(void)
+{
+    console_printf("%-8s %5s %8s %8s %8s %8s %s\n",
+                   "bench", "n", "min", "p50", "p90", "max", "unit");
+}
+
+/**
+ * Sorts the first n samples, and prints their distribution as one row.
+ */
+static void print_distribution(const char *name, int n, const char *unit)
+{
+    qsort(bench_samples, n, sizeof bench_samples[0], cmp_u32);
+    console_printf("%-8s %5d %8lu %8lu %8lu %8lu %s\n", name, n,
+                   (unsigned long)bench_samples[0],
+                   (unsigned long)bench_samples[n / 2],
+                   (unsigned long)bench_samples[n * 9 / 10],
+                   (unsigned long)bench_samples[n - 1], unit);
+}
+
+/**
+ * Reads n frames back to back. Reports the transaction time distribution,
+ * and the capture rate the bus allows (the sensor itself only refreshes
+ * every 100ms).
+ */
+static void bench_i2c(int n)
+{
+    uint8_t pixels[sizeof thermocam_last_frame.pixels];
+    uint32_t start;
+    uint32_t total_us;
+    int errors = 0;
+    int i;
+
+    start = os_cputime_get32();
+    for(i = 0; i < n; ++i) {
+        if(thermocam_camera_read(pixels, &bench_samples[i - errors], false) != 0) {
+            errors++;
+        }
+    }
+    total_us = os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+    if(total_us == 0) {
+        total_us = 1;
+    }
+
+    if(errors == n) {
+        console_printf("%-8s all %d reads failed\n", "i2c", n);
+        return;
+    }
+    print_distribution("i2c", n - errors, "us");
+    console_printf("%-8s %5d %8lu %8s %8s %8d fps, errors\n", "capture", n,
+                   (unsigned long)((uint64_t)(n - errors) * 1000000 / total_us),
+                   "", "", errors);
+}
+
+/**
+ * Pushes n rounds of notifications of the current frame to the peers
+ * subscribed at the start, as fast as the stack accepts them. A peer out of
+ * buffers is retried alone, the others are not notified twice. Samples are
+ * the time per round, the throughput counts the bytes of every peer. The
+ * burst is kept out of the notify stats and the peer counters.
+ */
+static void bench_notify(int n)
+{
+    const int frame_size = thermocam_settings.format == THERMOCAM_FMT_RAW ?
+        (int)sizeof thermocam_last_frame : THERMOCAM_PACKED_FRAME_LEN;
+    struct gatt_svr_peer peers[MYNEWT_VAL(BLE_MAX_CONNECTIONS)];
+    uint32_t start;
+    uint32_t total_us;
+    int count;
+    int rounds = 0;
+    int delivered = 0;
+    int retries = 0;
+    int rc = 0;
+    int i;
+
+    count = gatt_svr_peers(peers);
+    if(count == 0) {
+        console_printf("%-8s no subscribed peer\n", "notify");
+        return;
+    }
+
+    start = os_cputime_get32();
+    while(rounds < n && rc == 0) {
+        uint32_t t = os_cputime_get32();
+        for(i = 0; i < count; ++i) {
+            rc = gatt_svr_notify_peer(peers[i].conn_handle, false);
+            while(rc == BLE_HS_ENOMEM && retries < 100) {
+                retries++;
+                os_time_delay(1);
+                rc = gatt_svr_notify_peer(peers[i].conn_handle, false);
+            }
+            if(rc != 0) {
+                break;
+            }
+            delivered++;
+        }
+        if(rc == 0) {
+            bench_samples[rounds++] = os_cputime_ticks_to_usecs(os_cputime_get32() - t);
+        }
+    }
+    total_us = os_cputime_ticks_to_usecs(os_cputime_get32() - start);
+    if(total_us == 0) {
+        total_us = 1;
+    }
+
+    if(rounds == 0) {
+        console_printf("%-8s failed; rc=%d\n", "notify", rc);
+        return;
+    }
+    print_distribution("notify", rounds, "us");
+    console_printf("%-8s %5d %8lu %8lu %8d %8d B/s, frames/s, peers, retries\n",
+                   "tput", rounds,
+                   (unsigned long)((uint64_t)delivered * frame_size * 1000000 / total_us),
+                   (unsigned long)((uint64_t)rounds * 1000000 / total_us),
+                   count, retries);
+}
+
+static void bench_stack(void)
+{
+    struct os_task_info oti;
+    const struct os_task *t = NULL;
+
+    // high-water marks, in bytes
+    console_printf("%-12s %6s %6s\n", "task", "used", "size");
+    while((t = os_task_info_get_next(t, &oti)) != NULL) {
+        console_printf("%-12s %6u %6u\n", oti.oti_name,
+                       (unsigned)(oti.oti_stkusage * sizeof(os_stack_t)),
+                       (unsigned)(oti.oti_stksize * sizeof(os_stack_t)));
+    }
+}
+
+static int cam_bench_fn(int argc, char **argv)
+{
+    const char *what = argc > 1 ? argv[1] : "all";
+    int n = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_COUNT;
+
+    if(n < 1 || n > BENCH_MAX_SAMPLES) {
+        console_printf("count must be 1..%d\n", BENCH_MAX_SAMPLES);
+        return OS_EINVAL;
+    }
+
+    if(!strcmp(what, "i2c") || !strcmp(what, "all")) {
+        print_header();
+        bench_i2c(n);
+    }
+    if(!strcmp(what, "notify") || !strcmp(what, "all")) {
+        print_header();
+        bench_notify(n);
+    }
+    if(!strcmp(what, "stack") || !strcmp(what, "all")) {
+        bench_stack();
+    }
+    return 0;
+}
+
+static struct shell_cmd cam_bench_cmd = {
+    .sc_cmd = "cam_bench",
+    .sc_cmd_func = cam_bench_fn
+};
+
 void thermocam_shell_init(void)
 {
     THERMOCAM_LOG(INFO, "Shell command init\n");
     shell_cmd_register(&query_cam_cmd);
-}
\ No newline at end of file
+    shell_cmd_register(&cam_bench_cmd);
+    shell_cmd_register(&cam_peers_cmd);
+}
@@ -0,0 +1,55 @@
+#include "os/os.h"
+#include "stats/stats.h"
+#include "thermocam.h"
+
+STATS_SECT_DECL(thermocam_stats) thermocam_stats;
+
+STATS_NAME_START(thermocam_stats)
+    STATS_NAME(thermocam_stats, frames_captured)
+    STATS_NAME(thermocam_stats, frames_gated)
+    STATS_NAME(thermocam_stats, i2c_read_errors)
+    STATS_NAME(thermocam_stats, i2c_write_errors)
+    STATS_NAME(thermocam_stats, i2c_time_min_us)
+    STATS_NAME(thermocam_stats, i2c_time_avg_us)
+    STATS_NAME(thermocam_stats, i2c_time_max_us)
+    STATS_NAME(thermocam_stats, notify_sent)
+    STATS_NAME(thermocam_stats, notify_failed)
+    STATS_NAME(thermocam_stats, mbuf_alloc_failed)
+    STATS_NAME(thermocam_stats, conn_param_updates)
+    STATS_NAME(thermocam_stats, backlog_stored)
+    STATS_NAME(thermocam_stats, backlog_sent)
+    STATS_NAME(thermocam_stats, backlog_dropped)
+    STATS_NAME(thermocam_stats, backlog_flash_errors)
+STATS_NAME_END(thermocam_stats)
+
+/**
+ * Accounts the duration of one full frame transaction (register select
+ * plus pixel read). The average is a running average over roughly the
+ * last 8 frames.
+ */
+void thermocam_stats_i2c_time(uint32_t usecs)
+{
+    if (thermocam_stats.i2c_time_min_us == 0 || usecs < thermocam_stats.i2c_time_min_us) {
+        thermocam_stats.i2c_time_min_us = usecs;
+    }
+    if (usecs > thermocam_stats.i2c_time_max_us) {
+        thermocam_stats.i2c_time_max_us = usecs;
+    }
+    if (thermocam_stats.i2c_time_avg_us == 0) {
+        thermocam_stats.i2c_time_avg_us = usecs;
+    } else {
+        thermocam_stats.i2c_time_avg_us =
+            (thermocam_stats.i2c_time_avg_us * 7 + usecs) / 8;
+    }
+}
+
+void thermocam_stats_init(void)
+{
+    int rc;
+
+    rc = stats_init_and_reg(STATS_HDR(thermocam_stats),
+                            STATS_SIZE_INIT_PARMS(thermocam_stats, STATS_SIZE_32),
+                            STATS_NAME_INIT_PARMS(thermocam_stats),
+                            "thermocam");
+    assert(rc == 0);
+}
@@ -3,6 +3,11 @@
 #include "hal/hal_gpio.h"
 #include "thermocam.h"
 
+// not every bsp names its first led LED_1
+#ifndef LED_1
+#define LED_1 LED_BLINK_PIN
+#endif
+
 
 #define STATUS_LED_TASK_PRIO        (250)  /* 1 = highest, 255 = lowest */
 #define STATUS_LED_STACK_SIZE       OS_STACK_ALIGN(64)
@@ -6,10 +6,54 @@
 void thermocam_shell_init();
 
 // camera.c
-extern uint8_t thermocam_raw_image[128];
-extern uint32_t thermocam_frame_cnt;
+// Payload of the thermal image characteristic. Pixels are the raw AMG88xx
+// registers (64 x 12 bit, little endian), followed by the frame sequence
+// number and the capture time in ms since boot, both little endian.
+struct thermocam_frame {
+    uint8_t pixels[128];
+    uint32_t seq;
+    uint32_t timestamp_ms;
+} __attribute__((packed));
+extern struct thermocam_frame thermocam_last_frame;
+
+// Size of a frame in THERMOCAM_FMT_PACKED.
+#define THERMOCAM_PACKED_FRAME_LEN  (96 + 8)
 
 void thermocam_camera_init();
+void thermocam_camera_reconfigure(bool persist);
+void thermocam_camera_force_notify();
+int thermocam_camera_read(uint8_t *pixels, uint32_t *usecs, bool account);
+int16_t thermocam_pixel_value(const uint8_t *p);
+void thermocam_frame_pack(const struct thermocam_frame *frame, uint8_t *out);
+int thermocam_frame_append(struct os_mbuf *om, const struct thermocam_frame *frame,
+                           uint8_t format);
+
+// backlog.c
+void thermocam_backlog_init(struct os_eventq *evq);
+void thermocam_backlog_store(const struct thermocam_frame *frame);
+void thermocam_backlog_subscribe(uint16_t conn_handle, bool notify);
+uint32_t thermocam_backlog_pending();
+
+// settings.c
+#define THERMOCAM_FMT_RAW       0 /* raw pixel registers, as thermocam_frame */
+#define THERMOCAM_FMT_PACKED    1 /* 12 bit pixels packed to 96 bytes, then seq and timestamp */
+#define THERMOCAM_FMT_COUNT     2
+
+// Also the value of the settings characteristic, one byte each.
+struct thermocam_settings {
+    uint8_t fps;        /* sensor frame rate, 1 or 10 */
+    uint8_t averaging;  /* AMG88xx twice moving average mode, 0 or 1 */
+    uint8_t decimation; /* notify every n-th captured frame */
+    uint8_t format;     /* payload format, THERMOCAM_FMT_* */
+    uint8_t change_threshold; /* per pixel change to notify, 0.25 degC units, 0 = off */
+    uint8_t keepalive_s; /* notify at least this often while gated, in seconds */
+} __attribute__((packed));
+extern struct thermocam_settings thermocam_settings;
+
+void thermocam_settings_init();
+bool thermocam_settings_valid(const struct thermocam_settings *s);
+int thermocam_settings_update(const struct thermocam_settings *s);
+void thermocam_settings_save();
 
 // main.c
 #include "log/log.h"
@@ -30,11 +74,46 @@ void print_addr(const void *addr);
 // gatt_svr.c
 extern const ble_uuid128_t gatt_svr_svc_thermo_cam_uuid;
 extern uint16_t gatt_svr_chr_thermo_img_handle;
+extern uint16_t gatt_svr_chr_thermo_backlog_handle;
 void gatt_svr_register_cb(struct ble_gatt_register_ctxt *ctxt, void *arg);
-void gatt_svr_set_peer_to_notify(uint16_t conn_handle);
+// Notification state and counters of a subscribed peer.
+struct gatt_svr_peer {
+    uint16_t conn_handle; /* BLE_HS_CONN_HANDLE_NONE if the slot is free */
+    uint32_t notify_sent;
+    uint32_t notify_failed;
+};
+
+void gatt_svr_subscribe(uint16_t conn_handle, bool notify);
+void gatt_svr_conn_closed(uint16_t conn_handle);
 bool is_notification_enabled();
-void gatt_svr_notify();
+int gatt_svr_peers(struct gatt_svr_peer *peers);
+int gatt_svr_notify(bool account);
+int gatt_svr_notify_peer(uint16_t conn_handle, bool account);
 int thermocam_gatt_svr_init();
 
+// stats.c
+#include "stats/stats.h"
+STATS_SECT_START(thermocam_stats)
+    STATS_SECT_ENTRY(frames_captured)
+    STATS_SECT_ENTRY(frames_gated)
+    STATS_SECT_ENTRY(i2c_read_errors)
+    STATS_SECT_ENTRY(i2c_write_errors)
+    STATS_SECT_ENTRY(i2c_time_min_us)
+    STATS_SECT_ENTRY(i2c_time_avg_us)
+    STATS_SECT_ENTRY(i2c_time_max_us)
+    STATS_SECT_ENTRY(notify_sent)
+    STATS_SECT_ENTRY(notify_failed)
+    STATS_SECT_ENTRY(mbuf_alloc_failed)
+    STATS_SECT_ENTRY(conn_param_updates)
+    STATS_SECT_ENTRY(backlog_stored)
+    STATS_SECT_ENTRY(backlog_sent)
+    STATS_SECT_ENTRY(backlog_dropped)
+    STATS_SECT_ENTRY(backlog_flash_errors)
+STATS_SECT_END
+extern STATS_SECT_DECL(thermocam_stats) thermocam_stats;
+
+void thermocam_stats_init();
+void thermocam_stats_i2c_time(uint32_t usecs);
+
 // status_led.c
 void thermocam_status_led_init();
\ No newline at end of file
@@ -0,0 +1,7 @@
+// The app can't be a dependency of a test package, its sources under test
+// are compiled in here instead. camera.c and backlog.c are included by
+// camera_test.c and backlog_test.c, whose cases drive their static
+// callouts.
+#include "../../src/gatt_svr.c"
+#include "../../src/settings.c"
+#include "../../src/stats.c"
@@ -0,0 +1,335 @@
+#include <string.h>
+#include "thermocam_test.h"
+
+// whitebox: the cases below run the drain callout by hand. The host has no
+// controller, so the notifications go to the receiver below instead.
+#define ble_att_mtu             backlog_test_mtu
+#define ble_gattc_notify_custom backlog_test_notify
+#include "../../src/backlog.c"
+#undef ble_att_mtu
+#undef ble_gattc_notify_custom
+
+#define TEST_CONN_HANDLE    1
+
+// ATT MTU of the test connection, so a frame spans six notifications.
+#define TEST_MTU            23
+
+static struct os_eventq backlog_test_evq;
+
+// Next sequence number of the frames made up by store_frames().
+static uint32_t backlog_test_seq;
+
+// The stream as received by the peer, cut back into frames.
+static struct {
+    bool synthetic;     // frames come from store_frames(), check them all
+    bool fail_end;      // refuse the terminating empty notification
+    uint8_t frame[THERMOCAM_PACKED_FRAME_LEN];
+    uint16_t off;
+    uint8_t first[THERMOCAM_PACKED_FRAME_LEN];
+    uint32_t frames;
+    uint32_t first_seq;
+    uint32_t last_seq;
+    uint32_t bad_steps; // frames not THERMOCAM_BACKLOG_DECIMATION after the previous one
+    uint32_t bad_frames;
+    int empty;
+    bool ended;         // the last notification was empty
+} rx;
+
+static void make_frame(uint32_t seq, struct thermocam_frame *frame)
+{
+    int i;
+
+    for(i = 0; i < 64; ++i) {
+        uint16_t val = (seq + i) & 0x7ff;
+        frame->pixels[i * 2] = val & 0xff;
+        frame->pixels[i * 2 + 1] = val >> 8;
+    }
+    frame->seq = seq;
+    frame->timestamp_ms = seq * 100;
+}
+
+/**
+ * Offers the backlog the frames a disconnected camera would capture, of
+ * which it keeps every THERMOCAM_BACKLOG_DECIMATION-th.
+ */
+static void store_frames(int n)
+{
+    struct thermocam_frame frame;
+
+    while(n-- > 0) {
+        make_frame(backlog_test_seq++, &frame);
+        thermocam_backlog_store(&frame);
+    }
+}
+
+static void receive_frame(void)
+{
+    struct thermocam_frame frame;
+    uint8_t expected[THERMOCAM_PACKED_FRAME_LEN];
+    uint32_t seq;
+
+    memcpy(&seq, rx.frame + 96, sizeof seq);
+    if(rx.frames == 0) {
+        rx.first_seq = seq;
+        memcpy(rx.first, rx.frame, sizeof rx.first);
+    } else if(seq - rx.last_seq != MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION)) {
+        rx.bad_steps++;
+    }
+    if(rx.synthetic) {
+        make_frame(seq, &frame);
+        thermocam_frame_pack(&frame, expected);
+        if(memcmp(rx.frame, expected, sizeof expected) != 0) {
+            rx.bad_frames++;
+        }
+    }
+    rx.last_seq = seq;
+    rx.frames++;
+}
+
+uint16_t backlog_test_mtu(uint16_t conn_handle)
+{
+    return conn_handle == TEST_CONN_HANDLE ? TEST_MTU : 0;
+}
+
+int backlog_test_notify(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om)
+{
+    uint16_t len = OS_MBUF_PKTLEN(om);
+    uint16_t n;
+    uint16_t i;
+
+    TEST_ASSERT(conn_handle == TEST_CONN_HANDLE);
+    TEST_ASSERT(att_handle == gatt_svr_chr_thermo_backlog_handle);
+    TEST_ASSERT(len <= TEST_MTU - 3);
+    if(len == 0 && rx.fail_end) {
+        os_mbuf_free_chain(om);
+        return BLE_HS_ENOMEM;
+    }
+
+    for(i = 0; i < len; i += n) {
+        n = THERMOCAM_PACKED_FRAME_LEN - rx.off;
+        if(n > len - i) {
+            n = len - i;
+        }
+        os_mbuf_copydata(om, i, n, rx.frame + rx.off);
+        rx.off += n;
+        if(rx.off == THERMOCAM_PACKED_FRAME_LEN) {
+            receive_frame();
+            rx.off = 0;
+        }
+    }
+    if(len == 0) {
+        rx.empty++;
+    }
+    rx.ended = len == 0;
+    os_mbuf_free_chain(om);
+    return 0;
+}
+
+static void rx_reset(bool synthetic)
+{
+    memset(&rx, 0, sizeof rx);
+    rx.synthetic = synthetic;
+}
+
+/**
+ * Runs the drain callout while it keeps rescheduling itself, at most
+ * max_runs times.
+ */
+static void run_drain(int max_runs)
+{
+    while(max_runs-- > 0 && os_callout_queued(&backlog_drain_timer)) {
+        os_callout_stop(&backlog_drain_timer);
+        backlog_drain_cb(NULL);
+    }
+}
+
+/**
+ * Starts each case with an empty backlog and no subscriber.
+ */
+static void backlog_test_setup(void)
+{
+    static bool initialized;
+
+    if(!initialized) {
+        os_eventq_init(&backlog_test_evq);
+        thermocam_backlog_init(&backlog_test_evq);
+        TEST_ASSERT_FATAL(backlog_ready);
+        TEST_ASSERT_FATAL(backlog_fcb.f_sector_cnt >= 2);
+        initialized = true;
+    }
+
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, false);
+    os_callout_stop(&backlog_drain_timer);
+    fcb_clear(&backlog_fcb);
+    reset_position();
+    backlog_pending = 0;
+    backlog_decimation_cnt = 0;
+    rx_reset(true);
+}
+
+TEST_CASE(thermocam_test_backlog_store)
+{
+    uint8_t expected[THERMOCAM_PACKED_FRAME_LEN];
+    uint32_t stored;
+    uint32_t seq;
+
+    backlog_test_setup();
+    rx_reset(false);
+
+    // frames captured while disconnected go to the backlog, every
+    // THERMOCAM_BACKLOG_DECIMATION-th one
+    stored = thermocam_stats.backlog_stored;
+    seq = thermocam_last_frame.seq;
+    thermocam_test_connected = false;
+    thermocam_test_capture_frames(3 * MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+    thermocam_test_connected = true;
+    TEST_ASSERT(thermocam_stats.backlog_stored - stored == 3);
+    TEST_ASSERT(thermocam_backlog_pending() == 3);
+
+    // ... and come out packed, in order
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(100);
+    TEST_ASSERT(rx.frames == 3);
+    TEST_ASSERT(rx.off == 0);
+    TEST_ASSERT(rx.bad_steps == 0);
+    TEST_ASSERT(rx.first_seq == seq + MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+
+    // the scene is static, the pixels of every frame are those of the last
+    thermocam_frame_pack(&thermocam_last_frame, expected);
+    TEST_ASSERT(memcmp(rx.first, expected, 96) == 0);
+    TEST_ASSERT(memcmp(rx.frame, expected, 96) == 0);
+    TEST_ASSERT(rx.last_seq == thermocam_last_frame.seq);
+}
+
+TEST_CASE(thermocam_test_backlog_overflow)
+{
+    struct flash_area *last;
+    struct flash_area *oldest;
+    uint32_t oldest_entries;
+    uint32_t dropped;
+    uint32_t pending = 0;
+    uint32_t stored;
+    uint32_t sent;
+    int i;
+
+    backlog_test_setup();
+
+    // fill the sectors up to the last one, then until the oldest has to go:
+    // all of its frames are unsent and dropped
+    last = &backlog_sectors[backlog_fcb.f_sector_cnt - 1];
+    stored = thermocam_stats.backlog_stored;
+    for(i = 0; i < 100000 && backlog_fcb.f_active.fe_area != last; ++i) {
+        store_frames(MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+    }
+    TEST_ASSERT_FATAL(backlog_fcb.f_active.fe_area == last);
+    oldest = backlog_fcb.f_oldest;
+    oldest_entries = count_entries(oldest);
+    dropped = thermocam_stats.backlog_dropped;
+    for(i = 0; i < 100000 && backlog_fcb.f_oldest == oldest; ++i) {
+        pending = thermocam_backlog_pending();
+        store_frames(MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+    }
+    TEST_ASSERT_FATAL(backlog_fcb.f_oldest != oldest);
+    TEST_ASSERT(thermocam_stats.backlog_dropped - dropped == oldest_entries);
+    TEST_ASSERT(thermocam_backlog_pending() == pending + 1 - oldest_entries);
+    TEST_ASSERT(thermocam_stats.backlog_stored - stored ==
+                thermocam_backlog_pending() + oldest_entries);
+
+    // send a few frames of the new oldest sector, stopping within a frame,
+    // and fill the buffer again: the frames sent aren't dropped
+    oldest = backlog_fcb.f_oldest;
+    oldest_entries = count_entries(oldest);
+    sent = thermocam_stats.backlog_sent;
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(3);
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, false);
+    sent = thermocam_stats.backlog_sent - sent;
+    TEST_ASSERT_FATAL(sent > 0 && sent < oldest_entries);
+    TEST_ASSERT(rx.frames == sent);
+    TEST_ASSERT(rx.off != 0);
+    TEST_ASSERT(rx.bad_steps == 0 && rx.bad_frames == 0);
+
+    dropped = thermocam_stats.backlog_dropped;
+    for(i = 0; i < 100000 && backlog_fcb.f_oldest == oldest; ++i) {
+        store_frames(MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+    }
+    TEST_ASSERT_FATAL(backlog_fcb.f_oldest != oldest);
+    TEST_ASSERT(thermocam_stats.backlog_dropped - dropped == oldest_entries - sent);
+
+    // the next peer gets what is left, from a frame boundary
+    pending = thermocam_backlog_pending();
+    rx_reset(true);
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(100000);
+    TEST_ASSERT(rx.frames == pending);
+    TEST_ASSERT(rx.bad_steps == 0 && rx.bad_frames == 0);
+    TEST_ASSERT(rx.ended);
+    TEST_ASSERT(thermocam_backlog_pending() == 0);
+}
+
+TEST_CASE(thermocam_test_backlog_restart)
+{
+    uint32_t first_seq;
+    uint32_t sent;
+
+    backlog_test_setup();
+    store_frames(5 * MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+    TEST_ASSERT_FATAL(thermocam_backlog_pending() == 5);
+
+    // two runs send 160 bytes: a frame and part of the second one
+    sent = thermocam_stats.backlog_sent;
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(2);
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, false);
+    run_drain(100);
+    TEST_ASSERT_FATAL(rx.frames == 1);
+    TEST_ASSERT(rx.off == 2 * BACKLOG_CHUNKS_PER_RUN * (TEST_MTU - 3) - THERMOCAM_PACKED_FRAME_LEN);
+    TEST_ASSERT(thermocam_stats.backlog_sent - sent == 1);
+    TEST_ASSERT(thermocam_backlog_pending() == 4);
+    first_seq = rx.first_seq;
+
+    // the next subscription starts over with the frame that was cut short
+    rx_reset(true);
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(100);
+    TEST_ASSERT(rx.frames == 4);
+    TEST_ASSERT(rx.off == 0);
+    TEST_ASSERT(rx.first_seq == first_seq + MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+    TEST_ASSERT(rx.bad_steps == 0 && rx.bad_frames == 0);
+    TEST_ASSERT(rx.ended);
+    TEST_ASSERT(thermocam_stats.backlog_sent - sent == 5);
+}
+
+TEST_CASE(thermocam_test_backlog_end)
+{
+    backlog_test_setup();
+    store_frames(3 * MYNEWT_VAL(THERMOCAM_BACKLOG_DECIMATION));
+
+    // the frames are sent, but the stream isn't over until the empty
+    // notification is: the buffer is kept meanwhile
+    rx.fail_end = true;
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(10);
+    TEST_ASSERT(rx.frames == 3);
+    TEST_ASSERT(rx.empty == 0);
+    TEST_ASSERT(thermocam_backlog_pending() == 0);
+    TEST_ASSERT(!fcb_is_empty(&backlog_fcb));
+    TEST_ASSERT(os_callout_queued(&backlog_drain_timer));
+
+    // once it is sent, the buffer is cleared
+    rx.fail_end = false;
+    run_drain(10);
+    TEST_ASSERT(rx.frames == 3);
+    TEST_ASSERT(rx.empty == 1);
+    TEST_ASSERT(rx.ended);
+    TEST_ASSERT(fcb_is_empty(&backlog_fcb));
+    TEST_ASSERT(!os_callout_queued(&backlog_drain_timer));
+
+    // a later peer only gets the end of the stream
+    rx_reset(true);
+    thermocam_backlog_subscribe(TEST_CONN_HANDLE, true);
+    run_drain(10);
+    TEST_ASSERT(rx.frames == 0);
+    TEST_ASSERT(rx.empty == 1);
+    TEST_ASSERT(rx.ended);
+}
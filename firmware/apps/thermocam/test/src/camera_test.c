@@ -0,0 +1,312 @@
+#include <string.h>
+#include "amg88xx_sim/amg88xx_sim.h"
+#include "thermocam_test.h"
+
+// whitebox: the cases below run the acquisition callout by hand
+#include "../../src/camera.c"
+
+#define TEST_PERIOD_MS  100
+
+// Time of the idx-th frame slot after the acquisition timer was started.
+static os_time_t slot_ticks(uint32_t idx)
+{
+    return (os_time_t)(((uint64_t)idx * TEST_PERIOD_MS * OS_TICKS_PER_SEC) / 1000);
+}
+
+/**
+ * Applies default settings to the emulated sensor and restarts the
+ * acquisition grid at the current time. The OS isn't started, so the
+ * callout never fires by itself; run_next_frame() stands in for it.
+ */
+static void camera_test_setup(void)
+{
+    static bool initialized;
+
+    if(!initialized) {
+        os_mutex_init(&camera_i2c_lock);
+        os_eventq_init(&camera_evq);
+        os_callout_init(&camera_timer, &camera_evq, camera_timer_cb, NULL);
+        initialized = true;
+    }
+
+    amg88xx_sim_set_scene(AMG88XX_SIM_SCENE_GRADIENT);
+    amg88xx_sim_set_read_time(0);
+    amg88xx_sim_set_error_interval(0);
+
+    thermocam_settings.fps = 10;
+    thermocam_settings.averaging = 0;
+    thermocam_settings.decimation = 1;
+    thermocam_settings.format = THERMOCAM_FMT_RAW;
+    thermocam_settings.change_threshold = 0;
+    thermocam_settings.keepalive_s = 5;
+    apply_settings();
+}
+
+/**
+ * Advances the os time to the deadline of the acquisition callout, and
+ * runs it.
+ *
+ * @return                      The time the frame was captured at.
+ */
+static os_time_t run_next_frame(void)
+{
+    os_time_t now = os_time_get();
+    os_time_t ticks = os_callout_remaining_ticks(&camera_timer, now);
+
+    os_time_advance(ticks);
+    camera_timer_cb(NULL);
+    return now + ticks;
+}
+
+/**
+ * Captures n frames through the acquisition callout, for the cases of the
+ * modules it feeds.
+ */
+void thermocam_test_capture_frames(int n)
+{
+    camera_test_setup();
+    while(n-- > 0) {
+        run_next_frame();
+    }
+}
+
+static int16_t unpack_pixel(const uint8_t *packed, int i)
+{
+    const uint8_t *p = &packed[(i / 2) * 3];
+    int16_t val;
+
+    if(i % 2 == 0) {
+        val = p[0] | ((p[1] & 0x0f) << 8);
+    } else {
+        val = (p[1] >> 4) | (p[2] << 4);
+    }
+    return (val & 0x800) ? val - 0x1000 : val;
+}
+
+TEST_CASE(thermocam_test_payload_layout)
+{
+    struct thermocam_frame frame;
+    uint8_t buf[sizeof frame];
+    struct os_mbuf *om;
+    int rc;
+    int i;
+
+    // pixels cover negative values and all 12 bits
+    for(i = 0; i < 64; ++i) {
+        int16_t val = (int16_t)(i * 61 - 2048);
+        frame.pixels[i * 2] = val & 0xff;
+        frame.pixels[i * 2 + 1] = (val >> 8) & 0x0f;
+    }
+    frame.seq = 0x04030201;
+    frame.timestamp_ms = 0x08070605;
+
+    // raw: the registers, then seq and timestamp, little endian
+    om = os_msys_get_pkthdr(0, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    rc = thermocam_frame_append(om, &frame, THERMOCAM_FMT_RAW);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == 136);
+    rc = os_mbuf_copydata(om, 0, OS_MBUF_PKTLEN(om), buf);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(memcmp(buf, frame.pixels, 128) == 0);
+    for(i = 0; i < 8; ++i) {
+        TEST_ASSERT(buf[128 + i] == i + 1);
+    }
+    os_mbuf_free_chain(om);
+
+    // packed: two pixels in three bytes, then seq and timestamp
+    om = os_msys_get_pkthdr(0, 0);
+    TEST_ASSERT_FATAL(om != NULL);
+    rc = thermocam_frame_append(om, &frame, THERMOCAM_FMT_PACKED);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(OS_MBUF_PKTLEN(om) == THERMOCAM_PACKED_FRAME_LEN);
+    rc = os_mbuf_copydata(om, 0, OS_MBUF_PKTLEN(om), buf);
+    TEST_ASSERT_FATAL(rc == 0);
+    for(i = 0; i < 64; ++i) {
+        TEST_ASSERT(unpack_pixel(buf, i) == thermocam_pixel_value(&frame.pixels[i * 2]));
+    }
+    for(i = 0; i < 8; ++i) {
+        TEST_ASSERT(buf[96 + i] == i + 1);
+    }
+    os_mbuf_free_chain(om);
+}
+
+TEST_CASE(thermocam_test_frame_spacing)
+{
+    uint32_t captured;
+    os_time_t start;
+    os_time_t now;
+    os_time_t next;
+    int i;
+
+    camera_test_setup();
+    start = camera_timer_start;
+    captured = thermocam_stats.frames_captured;
+
+    // deadlines follow the absolute frame grid, the rounding of 100ms to
+    // whole ticks doesn't add up
+    for(i = 0; i < 50; ++i) {
+        TEST_ASSERT(run_next_frame() == start + slot_ticks(i));
+    }
+    TEST_ASSERT(thermocam_stats.frames_captured - captured == 50);
+
+    // a frame finishing 2.5 periods late skips the missed slots instead of
+    // bursting to catch up
+    os_time_advance(slot_ticks(52) + slot_ticks(1) / 2 - (os_time_get() - start));
+    camera_timer_cb(NULL);
+    now = os_time_get();
+    next = now + os_callout_remaining_ticks(&camera_timer, now);
+    TEST_ASSERT(next == start + slot_ticks(53));
+    TEST_ASSERT(thermocam_stats.frames_captured - captured == 51);
+}
+
+TEST_CASE(thermocam_test_capture)
+{
+    struct thermocam_frame first;
+    int x;
+    int y;
+
+    camera_test_setup();
+
+    run_next_frame();
+    first = thermocam_last_frame;
+    run_next_frame();
+
+    // the gradient scene, 22 degC plus 0.5 degC per column and 0.25 per row
+    for(y = 0; y < 8; ++y) {
+        for(x = 0; x < 8; ++x) {
+            TEST_ASSERT(thermocam_pixel_value(&thermocam_last_frame.pixels[(y * 8 + x) * 2]) ==
+                        22 * 4 + x * 2 + y);
+        }
+    }
+    TEST_ASSERT(thermocam_last_frame.seq == first.seq + 1);
+    TEST_ASSERT(thermocam_last_frame.timestamp_ms - first.timestamp_ms >= TEST_PERIOD_MS - 1000 / OS_TICKS_PER_SEC);
+    TEST_ASSERT(thermocam_last_frame.timestamp_ms - first.timestamp_ms <= TEST_PERIOD_MS + 1000 / OS_TICKS_PER_SEC);
+}
+
+TEST_CASE(thermocam_test_i2c_stats)
+{
+    uint8_t pixels[sizeof thermocam_last_frame.pixels];
+    uint32_t before;
+    uint32_t errors;
+    uint32_t usecs;
+    int rc;
+    int i;
+
+    camera_test_setup();
+
+    // every third transaction fails; every frame attempt ends up either
+    // captured or counted as an error
+    errors = thermocam_stats.i2c_write_errors + thermocam_stats.i2c_read_errors;
+    before = thermocam_stats.frames_captured + errors;
+    amg88xx_sim_set_error_interval(3);
+    for(i = 0; i < 30; ++i) {
+        run_next_frame();
+    }
+    amg88xx_sim_set_error_interval(0);
+    TEST_ASSERT(thermocam_stats.frames_captured + thermocam_stats.i2c_write_errors +
+                thermocam_stats.i2c_read_errors - before == 30);
+    TEST_ASSERT(thermocam_stats.i2c_write_errors + thermocam_stats.i2c_read_errors > errors);
+
+    // benchmark reads stay out of the timing stats
+    thermocam_stats.i2c_time_min_us = 7;
+    thermocam_stats.i2c_time_avg_us = 8;
+    thermocam_stats.i2c_time_max_us = 9;
+    rc = thermocam_camera_read(pixels, &usecs, false);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(thermocam_stats.i2c_time_min_us == 7);
+    TEST_ASSERT(thermocam_stats.i2c_time_avg_us == 8);
+    TEST_ASSERT(thermocam_stats.i2c_time_max_us == 9);
+
+    rc = thermocam_camera_read(pixels, &usecs, true);
+    TEST_ASSERT_FATAL(rc == 0);
+    TEST_ASSERT(thermocam_stats.i2c_time_min_us == (usecs < 7 ? usecs : 7));
+    TEST_ASSERT(thermocam_stats.i2c_time_avg_us == (8 * 7 + usecs) / 8);
+    TEST_ASSERT(thermocam_stats.i2c_time_max_us == (usecs > 9 ? usecs : 9));
+}
+
+// Copies the counters of a subscribed peer, false if it isn't subscribed.
+static bool find_test_peer(uint16_t conn_handle, struct gatt_svr_peer *peer)
+{
+    struct gatt_svr_peer peers[MYNEWT_VAL(BLE_MAX_CONNECTIONS)];
+    int count;
+    int i;
+
+    count = gatt_svr_peers(peers);
+    for(i = 0; i < count; ++i) {
+        if(peers[i].conn_handle == conn_handle) {
+            *peer = peers[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST_CASE(thermocam_test_notify_stats)
+{
+    const uint16_t conn_handle = 1;
+    struct gatt_svr_peer peer;
+    uint32_t sent;
+    uint32_t failed;
+    uint32_t gated;
+    int i;
+
+    camera_test_setup();
+
+    // without a subscriber nothing is attempted
+    failed = thermocam_stats.notify_failed;
+    run_next_frame();
+    TEST_ASSERT(thermocam_stats.notify_failed == failed);
+
+    // there is no such connection, every notification fails, and is
+    // accounted globally and for the peer
+    gatt_svr_subscribe(conn_handle, true);
+    TEST_ASSERT_FATAL(find_test_peer(conn_handle, &peer));
+    sent = thermocam_stats.notify_sent;
+    for(i = 0; i < 10; ++i) {
+        run_next_frame();
+    }
+    TEST_ASSERT(thermocam_stats.notify_sent == sent);
+    TEST_ASSERT(thermocam_stats.notify_failed - failed == 10);
+    TEST_ASSERT_FATAL(find_test_peer(conn_handle, &peer));
+    TEST_ASSERT(peer.notify_sent == 0);
+    TEST_ASSERT(peer.notify_failed == 10);
+
+    // every second frame with decimation 2
+    thermocam_settings.decimation = 2;
+    apply_settings();
+    for(i = 0; i < 10; ++i) {
+        run_next_frame();
+    }
+    TEST_ASSERT_FATAL(find_test_peer(conn_handle, &peer));
+    TEST_ASSERT(peer.notify_failed == 15);
+
+    // the static scene is gated after the forced first frame
+    thermocam_settings.decimation = 1;
+    thermocam_settings.change_threshold = 4;
+    apply_settings();
+    gated = thermocam_stats.frames_gated;
+    for(i = 0; i < 10; ++i) {
+        run_next_frame();
+    }
+    TEST_ASSERT_FATAL(find_test_peer(conn_handle, &peer));
+    TEST_ASSERT(peer.notify_failed == 16);
+    TEST_ASSERT(thermocam_stats.frames_gated - gated == 9);
+
+    // benchmark bursts stay out of the stats and the peer counters
+    failed = thermocam_stats.notify_failed;
+    TEST_ASSERT(gatt_svr_notify(false) != 0);
+    TEST_ASSERT(gatt_svr_notify_peer(conn_handle, false) != 0);
+    TEST_ASSERT(thermocam_stats.notify_failed == failed);
+    TEST_ASSERT_FATAL(find_test_peer(conn_handle, &peer));
+    TEST_ASSERT(peer.notify_failed == 16);
+
+    // a single peer notified on its own is accounted like the others
+    TEST_ASSERT(gatt_svr_notify_peer(conn_handle, true) != 0);
+    TEST_ASSERT(thermocam_stats.notify_failed - failed == 1);
+    TEST_ASSERT_FATAL(find_test_peer(conn_handle, &peer));
+    TEST_ASSERT(peer.notify_failed == 17);
+
+    gatt_svr_conn_closed(conn_handle);
+    TEST_ASSERT(!find_test_peer(conn_handle, &peer));
+}
@@ -0,0 +1,44 @@
+#include "sysinit/sysinit.h"
+#include "syscfg/syscfg.h"
+#include "host/ble_hs.h"
+#include "thermocam_test.h"
+#include "../../src/thermocam.h"
+
+struct log thermocam_log;
+
+// ble.c isn't part of the test, the camera believes a peer is connected
+// unless a case says otherwise.
+bool thermocam_test_connected = true;
+
+bool has_connected_peer(void)
+{
+    return thermocam_test_connected;
+}
+
+TEST_SUITE(thermocam_test_all)
+{
+    thermocam_test_payload_layout();
+    thermocam_test_frame_spacing();
+    thermocam_test_capture();
+    thermocam_test_i2c_stats();
+    thermocam_test_notify_stats();
+    thermocam_test_backlog_store();
+    thermocam_test_backlog_overflow();
+    thermocam_test_backlog_restart();
+    thermocam_test_backlog_end();
+}
+
+#if MYNEWT_VAL(SELFTEST)
+int main(int argc, char **argv)
+{
+    sysinit();
+
+    log_register("thermocam", &thermocam_log, &log_console_handler, NULL, LOG_SYSLEVEL);
+    log_register("ble_hs", &ble_hs_log, &log_console_handler, NULL, LOG_SYSLEVEL);
+    thermocam_stats_init();
+    thermocam_settings_init();
+
+    thermocam_test_all();
+    return tu_any_failed;
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include "testutil/testutil.h"
+
+extern bool thermocam_test_connected;
+
+void thermocam_test_capture_frames(int n);
+
+TEST_CASE_DECL(thermocam_test_payload_layout);
+TEST_CASE_DECL(thermocam_test_frame_spacing);
+TEST_CASE_DECL(thermocam_test_capture);
+TEST_CASE_DECL(thermocam_test_i2c_stats);
+TEST_CASE_DECL(thermocam_test_notify_stats);
+TEST_CASE_DECL(thermocam_test_backlog_store);
+TEST_CASE_DECL(thermocam_test_backlog_overflow);
+TEST_CASE_DECL(thermocam_test_backlog_restart);
+TEST_CASE_DECL(thermocam_test_backlog_end);
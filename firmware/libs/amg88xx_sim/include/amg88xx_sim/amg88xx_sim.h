@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+
+// Emulated AMG88xx sensor. Implements hal_i2c_master_write() and
+// hal_i2c_master_read() for bsps without an I2C bus (e.g. native), and
+// answers on MYNEWT_VAL(AMG88XX_SIM_I2C_ADDR) like the real sensor does:
+// register 0x02 selects 1 or 10 fps, 0x80.. hold the 64 pixels. The
+// pixels only change when the sensor's own frame clock ticks.
+
+#define AMG88XX_SIM_SCENE_GRADIENT  0
+#define AMG88XX_SIM_SCENE_BLOB      1
+#define AMG88XX_SIM_SCENE_SCRIPT    2
+
+// One step of a scripted scene: a hot spot of the given temperature at
+// (x, y), in 1/16 pixel units, held for the given number of sensor frames.
+struct amg88xx_sim_keyframe {
+    int16_t x;
+    int16_t y;
+    int16_t temp;       /* 0.25 degC units */
+    uint16_t frames;
+};
+
+void amg88xx_sim_set_scene(int scene);
+void amg88xx_sim_set_script(const struct amg88xx_sim_keyframe *keyframes, int count);
+void amg88xx_sim_set_read_time(uint32_t usecs);
+void amg88xx_sim_set_error_interval(uint32_t interval);
+uint32_t amg88xx_sim_frame_index(void);
+void amg88xx_sim_init(void);
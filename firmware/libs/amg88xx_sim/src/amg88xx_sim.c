@@ -0,0 +1,222 @@
+#include <string.h>
+#include "os/os.h"
+#include "os/os_cputime.h"
+#include "hal/hal_i2c.h"
+#include "syscfg/syscfg.h"
+#include "amg88xx_sim/amg88xx_sim.h"
+
+#define REG_FPSC        (0x02)
+#define REG_TTHL        (0x0E)
+#define REG_T01L        (0x80)
+
+#define BACKGROUND      (22 * 4)    /* 22 degC */
+#define BLOB_PEAK       (12 * 4)    /* blob is 12 degC above background */
+#define BLOB_RADIUS     (2 * 16)    /* 2 pixels, in 1/16 pixel units */
+
+static uint8_t regs[256];
+static uint8_t reg_ptr;
+
+static int scene = MYNEWT_VAL(AMG88XX_SIM_SCENE);
+static const struct amg88xx_sim_keyframe *script;
+static int script_len;
+static uint32_t read_time_us = MYNEWT_VAL(AMG88XX_SIM_READ_TIME_US);
+static uint32_t error_interval = MYNEWT_VAL(AMG88XX_SIM_ERROR_INTERVAL);
+static uint32_t transaction_cnt;
+
+static uint32_t rendered_frame = UINT32_MAX;
+static uint32_t noise_state = 0x12345678;
+
+/**
+ * Index of the frame the sensor currently exposes, based on its own clock
+ * running at the configured frame rate and drift.
+ */
+uint32_t amg88xx_sim_frame_index(void)
+{
+    const int64_t period_us = regs[REG_FPSC] == 1 ? 1000000 : 100000;
+    int64_t now = os_get_uptime_usec();
+
+    now += now * MYNEWT_VAL(AMG88XX_SIM_CLOCK_PPM) / 1000000;
+    return (uint32_t)(now / period_us);
+}
+
+static int16_t noise(void)
+{
+    const int amplitude = MYNEWT_VAL(AMG88XX_SIM_NOISE);
+
+    if (amplitude == 0) {
+        return 0;
+    }
+    // xorshift32
+    noise_state ^= noise_state << 13;
+    noise_state ^= noise_state >> 17;
+    noise_state ^= noise_state << 5;
+    return (int16_t)(noise_state % (2 * amplitude + 1)) - amplitude;
+}
+
+static int16_t hot_spot(int px, int py, int cx, int cy, int16_t peak)
+{
+    const int32_t dx = px * 16 - cx;
+    const int32_t dy = py * 16 - cy;
+    const int32_t d2 = dx * dx + dy * dy;
+    const int32_t r2 = BLOB_RADIUS * BLOB_RADIUS;
+
+    return d2 >= r2 ? 0 : (int16_t)(peak * (r2 - d2) / r2);
+}
+
+// bounces a coordinate between 0 and 7 pixels
+static int bounce(uint32_t t, int speed)
+{
+    const int range = 7 * 16;
+    const int pos = (int)((t * speed) % (2 * range));
+    return pos < range ? pos : 2 * range - pos;
+}
+
+static void render_frame(uint32_t frame)
+{
+    const struct amg88xx_sim_keyframe *kf = NULL;
+    int cx = 0;
+    int cy = 0;
+    int16_t peak = 0;
+    int x;
+    int y;
+
+    if (scene == AMG88XX_SIM_SCENE_BLOB) {
+        cx = bounce(frame, 3);
+        cy = bounce(frame, 2);
+        peak = BLOB_PEAK;
+    } else if (scene == AMG88XX_SIM_SCENE_SCRIPT && script_len > 0) {
+        uint32_t total = 0;
+        uint32_t t;
+        int i;
+
+        for (i = 0; i < script_len; ++i) {
+            total += script[i].frames;
+        }
+        t = total ? frame % total : 0;
+        for (i = 0; i < script_len; ++i) {
+            kf = &script[i];
+            if (t < kf->frames) {
+                break;
+            }
+            t -= kf->frames;
+        }
+        cx = kf->x;
+        cy = kf->y;
+        peak = kf->temp - BACKGROUND;
+    }
+
+    for (y = 0; y < 8; ++y) {
+        for (x = 0; x < 8; ++x) {
+            int16_t val = BACKGROUND + noise();
+            uint8_t *p = &regs[REG_T01L + (y * 8 + x) * 2];
+
+            if (scene == AMG88XX_SIM_SCENE_GRADIENT) {
+                val += x * 2 + y;
+            } else {
+                val += hot_spot(x, y, cx, cy, peak);
+            }
+
+            // 12 bit two's complement, little endian
+            p[0] = val & 0xff;
+            p[1] = (val >> 8) & 0x0f;
+        }
+    }
+}
+
+static int transaction_start(struct hal_i2c_master_data *pdata)
+{
+    if (pdata->address != MYNEWT_VAL(AMG88XX_SIM_I2C_ADDR)) {
+        return HAL_I2C_ERR_ADDR_NACK;
+    }
+    transaction_cnt++;
+    if (error_interval && transaction_cnt % error_interval == 0) {
+        return HAL_I2C_ERR_DATA_NACK;
+    }
+    return 0;
+}
+
+int hal_i2c_master_write(uint8_t i2c_num, struct hal_i2c_master_data *pdata,
+                         uint32_t timeout, uint8_t last_op)
+{
+    int rc;
+    int i;
+
+    rc = transaction_start(pdata);
+    if (rc != 0 || pdata->len == 0) {
+        return rc;
+    }
+
+    reg_ptr = pdata->buffer[0];
+    for (i = 1; i < pdata->len; ++i) {
+        regs[reg_ptr++] = pdata->buffer[i];
+    }
+    return 0;
+}
+
+int hal_i2c_master_read(uint8_t i2c_num, struct hal_i2c_master_data *pdata,
+                        uint32_t timeout, uint8_t last_op)
+{
+    uint32_t frame;
+    int rc;
+    int i;
+
+    rc = transaction_start(pdata);
+    if (rc != 0) {
+        return rc;
+    }
+
+    frame = amg88xx_sim_frame_index();
+    if (frame != rendered_frame) {
+        render_frame(frame);
+        rendered_frame = frame;
+    }
+
+    if (read_time_us) {
+        os_cputime_delay_usecs(read_time_us * pdata->len / 128);
+    }
+
+    for (i = 0; i < pdata->len; ++i) {
+        pdata->buffer[i] = regs[reg_ptr++];
+    }
+    return 0;
+}
+
+int hal_i2c_master_probe(uint8_t i2c_num, uint8_t address, uint32_t timeout)
+{
+    return address == MYNEWT_VAL(AMG88XX_SIM_I2C_ADDR) ? 0 : HAL_I2C_ERR_ADDR_NACK;
+}
+
+void amg88xx_sim_set_scene(int s)
+{
+    scene = s;
+    rendered_frame = UINT32_MAX;
+}
+
+/**
+ * Replaces the scene with keyframes, played in a loop. The array must
+ * outlive the emulation.
+ */
+void amg88xx_sim_set_script(const struct amg88xx_sim_keyframe *keyframes, int count)
+{
+    script = keyframes;
+    script_len = count;
+    amg88xx_sim_set_scene(AMG88XX_SIM_SCENE_SCRIPT);
+}
+
+void amg88xx_sim_set_read_time(uint32_t usecs)
+{
+    read_time_us = usecs;
+}
+
+void amg88xx_sim_set_error_interval(uint32_t interval)
+{
+    error_interval = interval;
+}
+
+void amg88xx_sim_init(void)
+{
+    memset(regs, 0, sizeof regs);
+    // thermistor reads 25 degC, in 0.0625 degC units
+    regs[REG_TTHL] = (25 * 16) & 0xff;
+    regs[REG_TTHL + 1] = (25 * 16) >> 8;
+}
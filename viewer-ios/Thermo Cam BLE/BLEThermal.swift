@@ -12,7 +12,94 @@ import CoreBluetooth
 
 
 protocol BLEHandlerDelegate : class {
-    func didReceiveNewImage(_ image: [Float])
+    func didReceiveNewImage(_ image: [Float], size: CGSize)
+}
+
+// How pixels are encoded in the characteristic value.
+enum PixelFormat {
+    case amg88xx       // 12 bit two's complement in 0.25 degC, 16 bit little endian or packed 3 bytes per 2 pixels
+    case centidegree16 // 16 bit two's complement little endian, in 0.01 degC
+}
+
+struct SensorType {
+    let name: String
+    let width: Int
+    let height: Int
+    let format: PixelFormat
+    
+    var pixelCount: Int {
+        return width * height
+    }
+    
+    var size: CGSize {
+        return CGSize(width: width, height: height)
+    }
+    
+    // bytes of the pixels of a frame, without the optional trailer
+    func payloadSize(packed: Bool) -> Int {
+        if format == .amg88xx && packed {
+            return (pixelCount + 1) / 2 * 3
+        }
+        return pixelCount * 2
+    }
+}
+
+// Sensors the viewer knows, the same table as the Windows viewer's. Payload
+// sizes are unique among them, so the sensor is recognized from the length
+// of the characteristic value.
+let knownSensors = [
+    SensorType(name: "AMG88xx", width: 8, height: 8, format: .amg88xx),
+    SensorType(name: "HTPA16x16", width: 16, height: 16, format: .centidegree16),
+    SensorType(name: "MLX90640", width: 32, height: 24, format: .centidegree16),
+    SensorType(name: "HTPA80x62", width: 80, height: 62, format: .centidegree16),
+]
+
+// sequence number and capture time the firmware may append to the pixels
+let frameTrailerSize = 8
+
+func sensorForPayload(_ length: Int) -> (sensor: SensorType, packed: Bool)? {
+    for sensor in knownSensors {
+        for packed in [false, true] {
+            if packed && sensor.format != .amg88xx {
+                continue
+            }
+            let size = sensor.payloadSize(packed: packed)
+            if length == size || length == size + frameTrailerSize {
+                return (sensor, packed)
+            }
+        }
+    }
+    return nil
+}
+
+// 12 bit two's complement
+private func signExtend12(_ pixel: UInt16) -> Float {
+    return Float(Int16(pixel & 0x07ff) - Int16(pixel & 0x0800))
+}
+
+// Temperatures in degC, row by row.
+func decodeFrame(_ data: [UInt8], sensor: SensorType, packed: Bool) -> [Float] {
+    var temperatures = [Float](repeating: 0, count: sensor.pixelCount)
+    switch sensor.format {
+    case .centidegree16:
+        for i in 0..<sensor.pixelCount {
+            let pixel = UInt16(data[i * 2]) | (UInt16(data[i * 2 + 1]) << 8)
+            temperatures[i] = Float(Int16(bitPattern: pixel)) / 100
+        }
+    case .amg88xx where packed:
+        for i in stride(from: 0, to: sensor.pixelCount, by: 2) {
+            let p = i / 2 * 3
+            temperatures[i] = signExtend12(UInt16(data[p]) | ((UInt16(data[p + 1]) & 0x0f) << 8)) / 4
+            if i + 1 < sensor.pixelCount {
+                temperatures[i + 1] = signExtend12((UInt16(data[p + 1]) >> 4) | (UInt16(data[p + 2]) << 4)) / 4
+            }
+        }
+    case .amg88xx:
+        for i in 0..<sensor.pixelCount {
+            temperatures[i] = signExtend12(UInt16(data[i * 2]) | (UInt16(data[i * 2 + 1]) << 8)) / 4
+        }
+    }
+    return temperatures
 }
 
 class BLEHandler : NSObject {
@@ -58,7 +145,7 @@ class BLEHandler : NSObject {
 
         updateDemoTemperatures()
         
-        self.delegate?.didReceiveNewImage(demoTemperatures)
+        self.delegate?.didReceiveNewImage(demoTemperatures, size: knownSensors[0].size)
         
         // reschedule a next demo image
         // resceduling afer frame is processed...
@@ -161,23 +248,15 @@ extension BLEHandler : CBPeripheralDelegate {
             }
             
             let intData = [UInt8](data)
-            var temperatures = [Float](repeating: 0, count: 64)
-            for i in 0..<64 {
-                let pixel = UInt16(intData[i * 2]) | (UInt16(intData[i * 2 + 1]) << 8)
-                let sign = pixel & 0x0400 != 0
-                if (!sign) {
-                    // positive
-                    temperatures[i] = Float(pixel & 0x07ff) / 4;
-                }
-                else {
-                    // negative
-                    temperatures[i] = -Float(((~pixel) & 0x07ff) + 1) / 4;
-                }
+            guard let frame = sensorForPayload(intData.count) else {
+                print("Unexpected image size \(intData.count)")
+                return
             }
+            let temperatures = decodeFrame(intData, sensor: frame.sensor, packed: frame.packed)
             
             //print("Received \(intData.count)")
             
-            self.delegate?.didReceiveNewImage(temperatures)
+            self.delegate?.didReceiveNewImage(temperatures, size: frame.sensor.size)
             
         default:
             print("Unexpected data received")
@@ -21,8 +21,9 @@
 
 + (void) scaleImageFromSize: (CGSize) inputSize andFromData: (float [_Nonnull]) inputData toSize: (CGSize) outputSize andToData: (float [_Nonnull]) outputData {
     
-    cv::Mat input(inputSize.width, inputSize.height, CV_32F, inputData);
-    cv::Mat output(outputSize.width, outputSize.height, CV_32F, outputData);
+    // rows, then columns
+    cv::Mat input(inputSize.height, inputSize.width, CV_32F, inputData);
+    cv::Mat output(outputSize.height, outputSize.width, CV_32F, outputData);
     
     cv::resize(input, output, output.size(), 0, 0, cv::INTER_CUBIC);
 }
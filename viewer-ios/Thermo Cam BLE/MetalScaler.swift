@@ -22,17 +22,33 @@ class MetalScaler
     // The compute pipeline generated from the compute kernel in the .metal shader file.
     private let scaleFunctionPSO: MTLComputePipelineState
     private let calculateCoeffsFunctionPSO: MTLComputePipelineState
-    private let normalizeCoeffsFunctionPSO: MTLComputePipelineState
     
     // The command queue used to pass commands to the device.
     private let commandQueue: MTLCommandQueue
     
     // Buffers to hold data.
-    private let inputBuffer: MTLBuffer
-    private let targetSizeBuffer: MTLBuffer
+    private var inputBuffer: MTLBuffer?
+    private let sizesBuffer: MTLBuffer // source width, source height, target width, target height
     private var resultBuffer: MTLBuffer?
     private var coeffBuffer: MTLBuffer?
     
+    // per axis coefficients, struct axis_tap in scaler.metal
+    private static let axisTapLength = 6 * MemoryLayout<Int32>.size + 6 * MemoryLayout<Float>.size
+    
+    // source size, the pixel grid of the sensor
+    private var _sourceSize = CGSize(width: 8, height: 8)
+    var sourceSize: CGSize {
+        get {
+            return _sourceSize
+        }
+        set {
+            workQueue.async {
+                [weak self] in
+                self?.changeSizes(source: newValue, target: self?._targetSize ?? newValue)
+            }
+        }
+    }
+    
     // target size
     private var _targetSize = CGSize(width: 8, height: 8)
     var targetSize: CGSize {
@@ -42,7 +58,7 @@ class MetalScaler
         set {
             workQueue.async {
                 [weak self] in
-                self?.changeTargetSize(newValue)
+                self?.changeSizes(source: self?._sourceSize ?? newValue, target: newValue)
             }
         }
     }
@@ -59,36 +75,40 @@ class MetalScaler
         let defaultLibrary = device.makeDefaultLibrary()
         let scaleFunction = defaultLibrary?.makeFunction(name: "scale")
         let calculateCoeffsFunction = defaultLibrary?.makeFunction(name: "init_coeff")
-        let normalizeCoeffsFunction = defaultLibrary?.makeFunction(name: "normalize_coeff")
         
         // Create a compute pipeline state object.
         do {
             scaleFunctionPSO = try device.makeComputePipelineState(function: scaleFunction!)
             calculateCoeffsFunctionPSO = try device.makeComputePipelineState(function: calculateCoeffsFunction!)
-            normalizeCoeffsFunctionPSO = try device.makeComputePipelineState(function: normalizeCoeffsFunction!)
         } catch {
             return nil
         }
         commandQueue = device.makeCommandQueue()!
         
-        inputBuffer = device.makeBuffer(length: 8*8*4, options: .storageModeShared)!
-        targetSizeBuffer = device.makeBuffer(length: 1*4, options: .storageModeShared)!
+        sizesBuffer = device.makeBuffer(length: 4*4, options: .storageModeShared)!
         
         workQueue = DispatchQueue(label: "MetalScaler", qos: .userInitiated)
     }
     
     
-    private func changeTargetSize(_ size: CGSize)
+    private func changeSizes(source: CGSize, target: CGSize)
     {
-        resultBuffer = device.makeBuffer(length: Int(size.width) * Int(size.height) * 4, options: .storageModeShared)
-        coeffBuffer = device.makeBuffer(length: Int(size.width) * Int(size.height) * 64 * 4, options: .storageModePrivate)
-        
-        let buffer = targetSizeBuffer.contents()
-        buffer.storeBytes(of: Float(size.width), as: Float.self)
-        
-        _targetSize = size
-        initializeCoeff(size)
-        normalizeCoeff(size)
+        let sourcePixelCount = Int(source.width) * Int(source.height)
+        if inputBuffer == nil || source != _sourceSize {
+            inputBuffer = device.makeBuffer(length: sourcePixelCount * 4, options: .storageModeShared)
+        }
+        resultBuffer = device.makeBuffer(length: Int(target.width) * Int(target.height) * 4, options: .storageModeShared)
+        coeffBuffer = device.makeBuffer(length: (Int(target.width) + Int(target.height)) * MetalScaler.axisTapLength, options: .storageModePrivate)
+        
+        let sizes = sizesBuffer.contents().bindMemory(to: Float.self, capacity: 4)
+        sizes[0] = Float(source.width)
+        sizes[1] = Float(source.height)
+        sizes[2] = Float(target.width)
+        sizes[3] = Float(target.height)
+        
+        _sourceSize = source
+        _targetSize = target
+        initializeCoeff(target)
     }
     
     private func initializeCoeff(_ size: CGSize) {
@@ -101,47 +121,11 @@ class MetalScaler
         // Encode the pipeline state object and its parameters.
         computeEncoder?.setComputePipelineState(calculateCoeffsFunctionPSO)
         computeEncoder?.setBuffer(coeffBuffer, offset: 0, index: 0)
-        computeEncoder?.setBuffer(targetSizeBuffer, offset: 0, index: 1)
+        computeEncoder?.setBuffer(sizesBuffer, offset: 0, index: 1)
         
-        // Calculate a threadgroup size
-        let coeffElements = Int(size.width) * Int(size.height)
+        // Calculate a threadgroup size, one thread per target column and row
+        let coeffElements = Int(size.width) + Int(size.height)
         let maxTotalThreads = calculateCoeffsFunctionPSO.maxTotalThreadsPerThreadgroup
-        assert(maxTotalThreads % 64 == 0)
-        let threadGroupHeight = maxTotalThreads / 64
-        let threadgroupCount = (coeffElements + threadGroupHeight - 1) / threadGroupHeight
-        let threadsPerThreadgroup = MTLSizeMake(64, threadGroupHeight, 1)
-        let threadgroupsPerGrid = MTLSizeMake(1, threadgroupCount, 1)
-        
-        // Encode the compute command.
-        computeEncoder?.dispatchThreadgroups(threadgroupsPerGrid, threadsPerThreadgroup: threadsPerThreadgroup)
-        
-        // End the compute pass.
-        computeEncoder?.endEncoding()
-        
-        // Execute the command.
-        commandBuffer?.commit()
-        
-        // Normally, you want to do other work in your app while the GPU is running,
-        // but in this example, the code simply blocks until the calculation is complete.
-        commandBuffer?.waitUntilCompleted()
-
-    }
-    
-    private func normalizeCoeff(_ size: CGSize) {
-        // Create a command buffer to hold commands.
-        let commandBuffer = commandQueue.makeCommandBuffer()
-        
-        // Start a compute pass.
-        let computeEncoder = commandBuffer?.makeComputeCommandEncoder()
-        
-        // Encode the pipeline state object and its parameters.
-        computeEncoder?.setComputePipelineState(normalizeCoeffsFunctionPSO)
-        computeEncoder?.setBuffer(coeffBuffer, offset: 0, index: 0)
-        computeEncoder?.setBuffer(targetSizeBuffer, offset: 0, index: 1)
-        
-        // Calculate a threadgroup size
-        let coeffElements = Int(size.width) * Int(size.height)
-        let maxTotalThreads = normalizeCoeffsFunctionPSO.maxTotalThreadsPerThreadgroup
         let threadGroupWidth = maxTotalThreads
         let threadgroupCount = (coeffElements + threadGroupWidth - 1) / threadGroupWidth
         let threadsPerThreadgroup = MTLSizeMake(threadGroupWidth, 1, 1)
@@ -159,6 +143,7 @@ class MetalScaler
         // Normally, you want to do other work in your app while the GPU is running,
         // but in this example, the code simply blocks until the calculation is complete.
         commandBuffer?.waitUntilCompleted()
+
     }
     
     func scale(_ heatMap: [Float], completionHandler delegate: ThermalImageConverterServiceDelegate?) {
@@ -170,10 +155,14 @@ class MetalScaler
     
     private func executeScale(_ heatMap: [Float], completionHandler ch: ThermalImageConverterServiceDelegate?) {
         
+        guard let inputBuffer = inputBuffer, heatMap.count == Int(_sourceSize.width) * Int(_sourceSize.height) else {
+            return // sizes not set yet, or frame of another sensor
+        }
+        
         heatMap.withUnsafeBufferPointer() {
             (heatMapBuffer: UnsafeBufferPointer)->Void in
             let buffer = inputBuffer.contents()
-            buffer.initializeMemory(as: Float.self, from: heatMapBuffer.baseAddress!, count: 64)
+            buffer.initializeMemory(as: Float.self, from: heatMapBuffer.baseAddress!, count: heatMapBuffer.count)
         }
         
         // Create a command buffer to hold commands.
@@ -187,7 +176,7 @@ class MetalScaler
         computeEncoder?.setBuffer(inputBuffer, offset: 0, index: 0)
         computeEncoder?.setBuffer(resultBuffer, offset: 0, index: 1)
         computeEncoder?.setBuffer(coeffBuffer, offset: 0, index: 2)
-        computeEncoder?.setBuffer(targetSizeBuffer, offset: 0, index: 3)
+        computeEncoder?.setBuffer(sizesBuffer, offset: 0, index: 3)
 
         // Calculate a threadgroup size
         let coeffElements = Int(_targetSize.width) * Int(_targetSize.height)
@@ -102,6 +102,7 @@ class ThermalImageConverterService : MetalScalerDelegate {
     private let scaler : MetalScaler?
     
     private let colorScale = ColorScale()
+    private var sourceSize = CGSize(width: 8, height: 8) // of the last frame, the scaler is resized when it changes
     private var _targetSize = CGSize(width: 414, height: 414)
     var targetSize : CGSize {
         set {
@@ -126,21 +127,25 @@ class ThermalImageConverterService : MetalScalerDelegate {
         }
     }
     
-    func startImageConversion(_ heatMap: [Float], completionHandler delegate: ThermalImageConverterServiceDelegate?)
+    func startImageConversion(_ heatMap: [Float], size: CGSize, completionHandler delegate: ThermalImageConverterServiceDelegate?)
     {
         
         if scaler != nil {
-            // Metal solution
+            // Metal solution, the resize is queued before the frame is scaled
+            if size != sourceSize {
+                sourceSize = size
+                scaler?.sourceSize = size
+            }
             scaler?.scale(heatMap, completionHandler: delegate)
         } else {
             DispatchQueue.global(qos: .userInitiated).async {
                 [weak self] in
-                self?.scaleWithOpenCV(heatMap, completionHandler: delegate)
+                self?.scaleWithOpenCV(heatMap, from: size, completionHandler: delegate)
             }
         }
     }
     
-    private func scaleWithOpenCV(_ heatMap: [Float], completionHandler delegate: ThermalImageConverterServiceDelegate?) {
+    private func scaleWithOpenCV(_ heatMap: [Float], from size: CGSize, completionHandler delegate: ThermalImageConverterServiceDelegate?) {
         
         let targetPixelCount = Int(_targetSize.width * _targetSize.height)
         
@@ -151,7 +156,7 @@ class ThermalImageConverterService : MetalScalerDelegate {
             (inputBuffer: UnsafeBufferPointer)->Void in
             scaled.withUnsafeMutableBufferPointer {
                 ( buf: inout UnsafeMutableBufferPointer)->Void in
-                ImageScaler.scaleImage(from: CGSize(width: 8, height: 8), andFromData: inputBuffer.baseAddress!, to: _targetSize, andToData: buf.baseAddress!)
+                ImageScaler.scaleImage(from: size, andFromData: inputBuffer.baseAddress!, to: _targetSize, andToData: buf.baseAddress!)
             }
         }
         
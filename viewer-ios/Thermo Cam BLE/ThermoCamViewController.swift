@@ -65,10 +65,10 @@ class ThermoCamViewController: UIViewController, BLEHandlerDelegate, ThermalImag
         print("\(ImageScaler.openCVVersionString())")
     }
 
-    func didReceiveNewImage(_ image: [Float]) {
+    func didReceiveNewImage(_ image: [Float], size: CGSize) {
         // this is called on a background thread
         
-        ThermalImageConverterService.shared.startImageConversion(image, completionHandler: self)
+        ThermalImageConverterService.shared.startImageConversion(image, size: size, completionHandler: self)
         
     }
 
@@ -11,31 +11,49 @@ using namespace metal;
 
 
 /*
-    coeff is layd out rows after rows,
+ The kernel is separable, so coefficients are stored per axis instead of
+ per target pixel: one axis_tap for each target column, followed by one
+ for each target row. A target pixel only reads the taps x taps source
+ pixels around it, so the cost does not grow with the size of the sensor.
  
-   0   1   2   3   4 ....  63
-  64  65  66  67  68 .... 127
- 128 129 130 131 132 .... 191
- 
- index.x -> pixel in resulting image goes from 0 .. <w*h, which is runtime value
- index.y -> pixel in source image, goes form 0 .. <64, which is constant, as we always scale 8x8 image
+ sizes_buf: source width, source height, target width, target height
  */
+
+constant int taps = 6;
+
+struct axis_tap
+{
+    int index[taps];    // source pixel, in the image
+    float weight[taps]; // normalized, 0 for source pixels outside the image
+};
+
 kernel void scale(device const float* input [[buffer(0)]],
                   device float* result [[buffer(1)]],
-                  device const float* coeff [[buffer(2)]],
-                  device const float* target_width_buf [[buffer(3)]], // single element
+                  device const axis_tap* coeff [[buffer(2)]],
+                  device const float* sizes_buf [[buffer(3)]],
                   uint index [[thread_position_in_grid]])
 {
-    const uint target_width = uint(target_width_buf[0]);
+    const uint source_width = uint(sizes_buf[0]);
+    const uint target_width = uint(sizes_buf[2]);
+    const uint target_height = uint(sizes_buf[3]);
     
-    if(index >= target_width * target_width) {
+    if(index >= target_width * target_height) {
         return; // last threadgroup includes thread off the buffer limit
     }
     
-    result[index] = 0;
-    for(int i = 0; i < 64; ++i) {
-        result[index] += input[i] * coeff[index * 64 + i];
+    const device axis_tap& column = coeff[index % target_width];
+    const device axis_tap& row = coeff[target_width + index / target_width];
+    
+    float accumulator = 0;
+    for(int j = 0; j < taps; ++j) {
+        const device float* source_row = input + row.index[j] * source_width;
+        float row_accumulator = 0;
+        for(int i = 0; i < taps; ++i) {
+            row_accumulator += source_row[column.index[i]] * column.weight[i];
+        }
+        accumulator += row_accumulator * row.weight[j];
     }
+    result[index] = accumulator;
 }
 
 static float sinc(const float x)
@@ -53,52 +71,40 @@ static float sinc3_weight(const float x)
     return fabs(x) >= 3 ? 0 : (normalized_sinc(x) * normalized_sinc(x / 3));
 }
 
-kernel void init_coeff(device float* coeff [[buffer(0)]],
-                       device const float* target_width_buf [[buffer(1)]], // single element
-                       uint2 index [[thread_position_in_grid]])
+kernel void init_coeff(device axis_tap* coeff [[buffer(0)]],
+                       device const float* sizes_buf [[buffer(1)]],
+                       uint index [[thread_position_in_grid]])
 {
-    const uint target_width = uint(target_width_buf[0]);
+    const uint target_width = uint(sizes_buf[2]);
+    const uint target_height = uint(sizes_buf[3]);
     
-    if(index.y >= target_width * target_width) {
+    if(index >= target_width + target_height) {
         return; // last threadgroup includes thread off the buffer limit
     }
     
-    const float source_x = float(index.x % 8);
-    const float source_y = float(index.x / 8);
-    const float target_x = float(index.y % target_width);
-    const float target_y = float(index.y / target_width);
+    const bool column = index < target_width;
+    const int source_size = int(column ? sizes_buf[0] : sizes_buf[1]);
+    const float target_size = column ? float(target_width) : float(target_height);
+    const float target = float(column ? index : index - target_width);
 
-    // Calculate float coordinates of target pixel in source coordinates.
-    // Original image covers (-0.5 .. 7.5, with a sample point at each integer)
+    // Calculate float coordinate of target pixel in source coordinates.
+    // Original image covers (-0.5 .. source_size - 0.5, with a sample point at each integer)
     // Target image should cover the same area, with evenly placed sample points
-    const float scaled_pixel_size = 8.0f / target_width;
+    const float scaled_pixel_size = source_size / target_size;
     const float scaled_range_start = -0.5f + scaled_pixel_size / 2.0f;
+    const float scaled_target = scaled_range_start + scaled_pixel_size * target;
     
-    const float scaled_target_x = scaled_range_start + scaled_pixel_size * target_x;
-    const float scaled_target_y = scaled_range_start + scaled_pixel_size * target_y;
-
-    const float diff_x = source_x - scaled_target_x;
-    const float diff_y = source_y - scaled_target_y;
-    
-    coeff[index.y * 64 + index.x] = sinc3_weight(diff_x) * sinc3_weight(diff_y);
-}
-
-kernel void normalize_coeff(device float* coeff [[buffer(0)]],
-                            device const float* target_width_buf [[buffer(1)]], // single element
-                            uint index [[thread_position_in_grid]])
-{
-    const uint target_width = uint(target_width_buf[0]);
-    
-    if(index >= target_width * target_width) {
-        return; // last threadgroup includes thread off the buffer limit
-    }
-    
-    float accumulator = 0.0;
-    for(int i = 0; i < 64; i++) {
-        accumulator += coeff[index * 64 + i];
+    // taps outside the image are left out, the rest renormalized
+    const int first = int(floor(scaled_target)) - 2;
+    float accumulator = 0;
+    for(int k = 0; k < taps; ++k) {
+        const int source = first + k;
+        const bool inside = source >= 0 && source < source_size;
+        coeff[index].index[k] = clamp(source, 0, source_size - 1);
+        coeff[index].weight[k] = inside ? sinc3_weight(scaled_target - source) : 0;
+        accumulator += coeff[index].weight[k];
     }
-    for(int i = 0; i < 64; i++) {
-        coeff[index * 64 + i] /= accumulator;
-        //coeff[index * 64 + i] = 1/64;
+    for(int k = 0; k < taps; ++k) {
+        coeff[index].weight[k] /= accumulator;
     }
 }
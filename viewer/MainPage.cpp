@@ -1,8 +1,11 @@
 ﻿#include "pch.h"
 #include "MainPage.h"
 #include "resample.h"
+#include "resamplecheck.h"
+#include "decode.h"
 
 using namespace winrt;
+using namespace Windows::Graphics::Display;
 using namespace Windows::Graphics::Imaging;
 using namespace Windows::Storage::Streams;
 using namespace Windows::UI;
@@ -13,6 +16,64 @@ using namespace Windows::UI::Xaml::Media;
 
 namespace winrt::viewer::implementation
 {
+	static const uint16_t frame_server_port = 8088;
+	static const wchar_t * const frame_ring_name = L"thermocam-frames";
+	static const uint32_t frame_ring_slots = 16;
+
+	// Hotspots and the shared memory ring work on the first pyramid level at
+	// least analysis_width wide, whatever the window size.
+	static const int analysis_width = 100;
+
+	// The displayed image is rendered at the size of the viewport, rounded up
+	// to a multiple of render_width_step so resizing the window only creates a
+	// bounded number of resampling plans.
+	static const int default_render_width = 100;
+	static const int render_width_step = 16;
+	static const int max_render_width = 2048;
+
+	// Bucket sizes of the statistics grow with the sensor to stay within
+	// this, the default windows would take 52 MB at 80x62.
+	static const size_t statistics_memory_limit = 8 * 1024 * 1024;
+
+	static int renderWidth(const SensorGeometry & geometry, const int viewport_width, const int viewport_height)
+	{
+		if (viewport_width <= 0 || viewport_height <= 0) {
+			return default_render_width;
+		}
+		// the image is stretched uniformly, it fills the viewport in one direction only
+		const int fit = std::min(viewport_width, viewport_height * geometry.width / geometry.height);
+		const int width = (fit + render_width_step - 1) / render_width_step * render_width_step;
+		return std::max(render_width_step, std::min(max_render_width, width));
+	}
+
+	// Bytes of the largest analysis field of the known sensors.
+	static size_t analysisFieldSize()
+	{
+		size_t count;
+		const SensorType * sensors = knownSensors(&count);
+		size_t largest = 0;
+		for (size_t i = 0; i < count; ++i) {
+			int width = sensors[i].geometry.width;
+			int height = sensors[i].geometry.height;
+			while (width < analysis_width) {
+				width *= 2;
+				height *= 2;
+			}
+			largest = std::max(largest, static_cast<size_t>(width) * height * sizeof(float));
+		}
+		return largest;
+	}
+
+	// The options of the options panel persist in the local settings of the app.
+	template <typename T> static T loadOption(const wchar_t * key, const T fallback)
+	{
+		return unbox_value_or<T>(Windows::Storage::ApplicationData::Current().LocalSettings().Values().TryLookup(key), fallback);
+	}
+
+	template <typename T> static void storeOption(const wchar_t * key, const T value)
+	{
+		Windows::Storage::ApplicationData::Current().LocalSettings().Values().Insert(key, box_value(value));
+	}
 
 	std::vector<uint32_t> GenerateIronScale()
 	{
@@ -62,22 +123,60 @@ namespace winrt::viewer::implementation
 		return colorScale;
 	}
 
-	MainPage::MainPage() : client{ nullptr }, thermocamChr{ nullptr }, min{ 20 }, max{ 30 }, seekConnection(false),
-		imageGrabberTimestamp { nullptr }
+	MainPage::MainPage() : client{ nullptr }, thermocamChr{ nullptr }, min{ 20 }, max{ 30 }, seekConnection(false), analyticsOnly(false), autoGain(false), fixedPoint(false),
+		showStatistics(false), displayStatistic(PixelStatistic::Max), displayWindow(StatisticsWindow::Minute), rewindSeconds(0), geometry(amg88xx_geometry)
     {
         InitializeComponent();
 		NotifyUser(L"", NotifyType::StatusMessage);
 		clientAddr = 0;
+		streamResetPending = false;
+		viewportWidth = 0;
+		viewportHeight = 0;
 		advWatcher.Received({ this, &MainPage::OnAdvertisementReceived });
 		advWatcher.Stopped({ this, &MainPage::OnAdvertisementStopped });
 
 		thermalImage().Source(thermocamBitmap);
+		thermalImage().SizeChanged([this](auto &&, auto &&) { OnViewportChanged(); });
+		DisplayInformation::GetForCurrentView().DpiChanged([this](auto &&, auto &&) { OnViewportChanged(); });
 
 		colorScale = GenerateIronScale();
 
-		imageGrabberTimestamp = ThreadPoolTimer::CreatePeriodicTimer({ this, &MainPage::OnGrabImageTime }, std::chrono::milliseconds(100));
+		// the options of the last session, before any frame is processed
+		analyticsOnly = loadOption(L"analyticsOnly", false);
+		AnalyticsOnlySwitch().IsOn(analyticsOnly);
+		autoGain = loadOption(L"autoGain", false);
+		AutoGainSwitch().IsOn(autoGain);
+		fixedPoint = loadOption(L"fixedPoint", false);
+		FixedPointSwitch().IsOn(fixedPoint);
+		showStatistics = loadOption(L"showStatistics", false);
+		StatisticsSwitch().IsOn(showStatistics);
+		displayStatistic = static_cast<PixelStatistic>(loadOption(L"displayStatistic", static_cast<int32_t>(PixelStatistic::Max)));
+		StatisticBox().SelectedIndex(static_cast<int32_t>(displayStatistic));
+		displayWindow = static_cast<StatisticsWindow>(loadOption(L"displayWindow", static_cast<int32_t>(StatisticsWindow::Minute)));
+		WindowBox().SelectedIndex(static_cast<int32_t>(displayWindow));
+
+		frameServer.StartAsync(frame_server_port);
+		frameRing.Create(frame_ring_name, frame_ring_slots, analysisFieldSize());
+
+#ifdef _DEBUG
+		// accuracy and cost of the resampling kernels, in the debugger output.
+		// A kernel that no longer matches its golden values stops here.
+		executor.Post([] {
+			const auto reports = runResampleHarness();
+			OutputDebugStringA(formatResampleReport(reports).c_str());
+			assert(std::all_of(reports.begin(), reports.end(), [](const ResampleKernelReport & r) { return r.goldenMatch; }));
+		});
+#endif
     }
 
+	MainPage::~MainPage()
+	{
+		// no new frames, then whatever the acquisition and the options
+		// panel queued must run while the members it uses still exist
+		DisconnectBLE();
+		executor.Drain();
+	}
+
 	const GUID MainPage::thermocamServiceUUID = { 0x97B8FCA2, 0x45A8, 0x478C, 0x9E, 0x85, 0xCC, 0x85, 0x2A, 0xF2, 0xE9, 0x50 };
 	const GUID MainPage::thermocamCharacteristiccUUID = { 0x52e66cfc, 0x9dd2, 0x4932, 0x8e, 0x81, 0x7e, 0xaf, 0x2c, 0x6e, 0x2c, 0x53 };
 
@@ -108,29 +207,65 @@ namespace winrt::viewer::implementation
 		NotifyUser(L"BLE Name changed.", NotifyType::ErrorMessage);
 	}
 
-	void MainPage::OnGrabImageTime(ThreadPoolTimer timer)
+	void MainPage::OnViewportChanged()
 	{
-		// it is possible, that one execution of this callback
-		// is not yet complete, while the next period is already over,
-		// and the function is invoked again. Ensure that actuayl image
-		// grabbing happens only on one thread.
+		const double scale = DisplayInformation::GetForCurrentView().RawPixelsPerViewPixel();
+		viewportWidth = static_cast<int>(thermalImage().ActualWidth() * scale);
+		viewportHeight = static_cast<int>(thermalImage().ActualHeight() * scale);
+	}
 
-		std::unique_lock lock_guard(grabberLock, std::defer_lock);
+	void MainPage::AnalyticsOnlyToggled(IInspectable const& sender, RoutedEventArgs const& args)
+	{
+		const bool on = AnalyticsOnlySwitch().IsOn();
+		storeOption(L"analyticsOnly", on);
+		executor.Post([this, on] { analyticsOnly = on; });
+	}
 
-		if (!lock_guard.try_lock()) {
-			return; // if failed to get the lock, do nothing else
-		}
+	void MainPage::AutoGainToggled(IInspectable const& sender, RoutedEventArgs const& args)
+	{
+		const bool on = AutoGainSwitch().IsOn();
+		storeOption(L"autoGain", on);
+		executor.Post([this, on] { autoGain = on; });
+	}
 
-		if (!thermocamChr) {
-			return; // if the characteristic is unknown, image cannot be graddeb
+	void MainPage::FixedPointToggled(IInspectable const& sender, RoutedEventArgs const& args)
+	{
+		const bool on = FixedPointSwitch().IsOn();
+		storeOption(L"fixedPoint", on);
+		executor.Post([this, on] { fixedPoint = on; });
+	}
+
+	void MainPage::StatisticsToggled(IInspectable const& sender, RoutedEventArgs const& args)
+	{
+		const bool on = StatisticsSwitch().IsOn();
+		storeOption(L"showStatistics", on);
+		executor.Post([this, on] { showStatistics = on; });
+	}
+
+	void MainPage::StatisticSelected(IInspectable const& sender, Controls::SelectionChangedEventArgs const& args)
+	{
+		const int32_t index = StatisticBox().SelectedIndex();
+		if (index < 0) {
+			return;
 		}
+		storeOption(L"displayStatistic", index);
+		executor.Post([this, index] { displayStatistic = static_cast<PixelStatistic>(index); });
+	}
 
-		GattReadResult result = thermocamChr.ReadValueAsync(BluetoothCacheMode::Uncached).get();
-		if (result.Status() != GattCommunicationStatus::Success) {
-			NotifyUser(L"Failed to read image.", NotifyType::ErrorMessage);
+	void MainPage::WindowSelected(IInspectable const& sender, Controls::SelectionChangedEventArgs const& args)
+	{
+		const int32_t index = WindowBox().SelectedIndex();
+		if (index < 0) {
 			return;
 		}
-		ProcessThermocamImageData(result.Value());
+		storeOption(L"displayWindow", index);
+		executor.Post([this, index] { displayWindow = static_cast<StatisticsWindow>(index); });
+	}
+
+	void MainPage::RewindChanged(IInspectable const& sender, Controls::Primitives::RangeBaseValueChangedEventArgs const& args)
+	{
+		const double seconds = args.NewValue();
+		executor.Post([this, seconds] { rewindSeconds = seconds; });
 	}
 
 	void MainPage::OnThermocamImageUpdate(GattCharacteristic chr, GattValueChangedEventArgs eventArgs)
@@ -143,42 +278,159 @@ namespace winrt::viewer::implementation
 		static int cnt = 0;
 
 		DataReader reader = DataReader::FromBuffer(buffer);
-		std::vector<uint8_t> data(128, 0);
+		std::vector<uint8_t> data(buffer.Length(), 0);
 		reader.ReadBytes(data);
 
-		std::vector<float> temperatures(64, 0.0f);
-		for (unsigned i = 0; i < 64; ++i) {
-			const uint16_t pixel = data[i * 2] | (data[i * 2 + 1] << 8);
-			const bool sign = pixel & 0x0400;
-			if (!sign) {
-				// positive
-				temperatures[i] = static_cast<float>(pixel & 0x07ff) / 4;
+		// the sensor type is recognized from the payload size
+		const SensorType * sensor = sensorForPayload(data.size());
+		if (!sensor) {
+			NotifyUser(L"Unexpected image size.", NotifyType::ErrorMessage);
+			return;
+		}
+		if (sensor->geometry != geometry) {
+			geometry = sensor->geometry;
+			denoiser = TemporalDenoiser(geometry.PixelCount(), denoiser.Params());
+			history.Reset(geometry.PixelCount());
+			statistics = PixelStatistics(geometry.PixelCount(), StatisticsParams::ForMemoryLimit(geometry.PixelCount(), statistics_memory_limit));
+			streamResetPending = true;
+		}
+
+		calibration.SetSensor(*sensor);
+		calibration.ReloadIfChanged();
+		std::vector<float> temperatures(geometry.PixelCount(), 0.0f);
+		ThermocamFrameInfo info;
+		decodeThermocamImage(data.data(), data.size(), *sensor, temperatures.data(), calibration.Current().get(), &info);
+
+		// filter sensor noise on the source samples, before it gets spread by the resampling
+		if (streamResetPending.exchange(false)) {
+			denoiser.Reset();
+			history.Reset();
+			statistics.Reset();
+			agc.Reset();
+			hotspots.Reset();
+			occupancy.Reset();
+		}
+		denoiser.Filter(temperatures);
+
+		// presence detection works on the 8x8 grid only
+		const OccupancyResult presence = geometry == amg88xx_geometry ? occupancy.Update(temperatures.data()) : OccupancyResult{};
+
+		const std::vector<float> samples = temperatures;
+		const double timestamp = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		history.Append(samples.data(), timestamp);
+		statistics.Add(samples.data(), timestamp);
+
+		PublishedFrame published = { info.hasSequence ? info.sequence : static_cast<uint32_t>(cnt), data.data(), data.size(),
+			samples.data(), geometry.width, geometry.height, nullptr, 0, 0 };
+		FrameRingSlot field = {};
+		field.sequenceNumber = published.sequence;
+		field.format = static_cast<uint16_t>(FrameFormat::Decoded);
+		field.timestampUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+		if (analyticsOnly) {
+			// presence detection only, no image
+			frameServer.Publish(published);
+			field.width = static_cast<uint16_t>(geometry.width);
+			field.height = static_cast<uint16_t>(geometry.height);
+			field.length = static_cast<uint32_t>(samples.size() * sizeof(float));
+			frameRing.Publish(field, samples.data());
+			std::wstring log = std::wstring(L"People: ") + std::to_wstring(presence.people) + (presence.learning ? L" (learning)" : L"") + (presence.motion ? L" motion" : L"") + L" cnt: " + std::to_wstring(cnt++);
+			NotifyUser(log, NotifyType::StatusMessage);
+			return;
+		}
+
+		// analytics and the ring get a pyramid level of a fixed size, computed once per frame
+		pyramid.SetFrame(samples.data(), geometry);
+		const int level = pyramid.LevelFor(analysis_width);
+		const float * analysis = pyramid.Level(level);
+		field.width = static_cast<uint16_t>(pyramid.LevelWidth(level));
+		field.height = static_cast<uint16_t>(pyramid.LevelHeight(level));
+		field.length = static_cast<uint32_t>(field.width * field.height * sizeof(float));
+		frameRing.Publish(field, analysis);
+
+		const auto & tracked = hotspots.Update(analysis, field.width, field.height, timestamp);
+		const auto visibleHotspots = std::count_if(tracked.begin(), tracked.end(), [](const Hotspot & h) { return h.missedFrames == 0; });
+
+		// a rewound view follows the live one at a delay, through the same
+		// palette path, as far back as the history goes
+		const bool rewound = rewindSeconds > 0 && !history.Empty();
+		if (rewound) {
+			uint64_t index;
+			if (!history.Find(timestamp - rewindSeconds, &index)) {
+				index = history.FirstIndex();
+			}
+			history.Read(index, temperatures.data());
+		}
+		if (showStatistics) {
+			statistics.Query(displayWindow, displayStatistic, temperatures.data());
+		}
+
+		// resample the image to the size it is displayed at, keeping the aspect ratio of the sensor
+		const int scaled_width = renderWidth(geometry, viewportWidth, viewportHeight);
+		const int scaled_height = geometry.ScaledHeight(scaled_width);
+		std::vector<FixedTemperature> fixedField;
+		float frameMin, frameMax;
+		if (fixedPoint) {
+			std::vector<FixedTemperature> fixedSamples(temperatures.size());
+			toFixedTemperatures(temperatures.data(), fixedSamples.data(), fixedSamples.size());
+			fixedField.resize(scaled_width * scaled_height);
+			getFixedResamplePlan(geometry, scaled_width, scaled_height)->Apply(fixedSamples.data(), fixedField.data());
+			const auto minmax = std::minmax_element(fixedField.begin(), fixedField.end());
+			frameMin = fromFixedTemperature(*minmax.first);
+			frameMax = fromFixedTemperature(*minmax.second);
+		}
+		else {
+			if (showStatistics || rewound) {
+				temperatures = resampleThermalImage(temperatures, geometry, scaled_width, scaled_height);
 			}
 			else {
-				// negative
-				temperatures[i] = -static_cast<float>(((~pixel) & 0x07ff) + 1) / 4;
+				// the live frame is in the pyramid already: the level itself when
+				// the render width is one, otherwise the whole frame as a region
+				// through the pyramid's cached plan
+				const int displayLevel = pyramid.LevelFor(scaled_width);
+				if (pyramid.LevelWidth(displayLevel) == scaled_width) {
+					const float * values = pyramid.Level(displayLevel);
+					temperatures.assign(values, values + scaled_width * scaled_height);
+				}
+				else {
+					temperatures.resize(scaled_width * scaled_height);
+					pyramid.Region(scaled_width, 0, scaled_width, 0, scaled_height, temperatures.data());
+				}
 			}
+			const auto minmax = std::minmax_element(temperatures.begin(), temperatures.end());
+			frameMin = *minmax.first;
+			frameMax = *minmax.second;
 		}
 
-		const int scaled_size = 100; // resample image to 100x100
-		temperatures = resampleThermalImage(temperatures, scaled_size);
-
-		const auto minmax = std::minmax_element(temperatures.begin(), temperatures.end());
-
-		if (*minmax.first < min) {
-			min = *minmax.first;
+		if (frameMin < min) {
+			min = frameMin;
 		}
-		if (*minmax.second > max) {
-			max = *minmax.second;
+		if (frameMax > max) {
+			max = frameMax;
 		}
 		if (max == min) {
 			max = min + 0.25;
 		}
 
-		std::wstring log = std::wstring(L"Min: ") + std::to_wstring(*minmax.first) + L"(" + std::to_wstring(min) + L") max: " + std::to_wstring(*minmax.second) + L"(" + std::to_wstring(max) + L") cnt: " + std::to_wstring(cnt++);
+		std::wstring log = std::wstring(L"Min: ") + std::to_wstring(frameMin) + L"(" + std::to_wstring(min) + L") max: " + std::to_wstring(frameMax) + L"(" + std::to_wstring(max) + L") cnt: " + std::to_wstring(cnt++) + L" hotspots: " + std::to_wstring(visibleHotspots) + L" people: " + std::to_wstring(presence.people);
 		NotifyUser(log, NotifyType::StatusMessage);
 
-		SoftwareBitmap sb(BitmapPixelFormat::Bgra8, scaled_size, scaled_size, BitmapAlphaMode::Premultiplied);
+		// the palette spans min to max linearly, or the equalized table spans the AGC range
+		const uint32_t * palette = colorScale.data();
+		float low = min;
+		float high = max;
+		if (autoGain) {
+			if (fixedPoint) {
+				agc.Update(fixedField.data(), fixedField.size(), colorScale.data());
+			}
+			else {
+				agc.Update(temperatures.data(), temperatures.size(), colorScale.data());
+			}
+			palette = agc.Table();
+			low = agc.Low();
+			high = agc.High();
+		}
+
+		SoftwareBitmap sb(BitmapPixelFormat::Bgra8, scaled_width, scaled_height, BitmapAlphaMode::Premultiplied);
 		{
 			auto buffer = sb.LockBuffer(BitmapBufferAccessMode::Write);
 			auto reference = buffer.CreateReference();
@@ -188,10 +440,21 @@ namespace winrt::viewer::implementation
 			interop->GetBuffer(&data, &length);
 			uint32_t * pixels = reinterpret_cast<uint32_t *>(data);
 
-			for (unsigned i = 0; i < scaled_size * scaled_size; ++i) {
-				const uint8_t pixel = static_cast<uint8_t>((temperatures[i] - min) / (max - min) * 255);
-				pixels[i] = colorScale[pixel];
+			if (fixedPoint) {
+				colorizeFixed(fixedField.data(), fixedField.size(), toFixedTemperature(low), toFixedTemperature(high), palette, pixels);
 			}
+			else {
+				const float scale = 255 / (high - low);
+				for (int i = 0; i < scaled_width * scaled_height; ++i) {
+					const float position = (temperatures[i] - low) * scale;
+					pixels[i] = palette[position < 0 ? 0 : (position > 255 ? 255 : static_cast<uint8_t>(position))];
+				}
+			}
+
+			published.image = pixels;
+			published.imageWidth = scaled_width;
+			published.imageHeight = scaled_height;
+			frameServer.Publish(published);
 		}
 
 		Dispatcher().RunAsync(CoreDispatcherPriority::Normal, [sb, this]() {
@@ -205,6 +468,13 @@ namespace winrt::viewer::implementation
 		if (requestCount.compare_exchange_strong(expected, 0)) {
 			displayRequest.RequestRelease();
 		}
+		streamResetPending = true;
+		calibration.Close();
+
+		if (acquisition) {
+			acquisition->Stop();
+			acquisition = nullptr;
+		}
 
 		if (thermocamChr) {
 			if (tokenForCharacteristicValueChanged) {
@@ -293,6 +563,14 @@ namespace winrt::viewer::implementation
 
 		thermocamChr = thermocamCharacteristics.GetAt(0);
 
+		// per sensor calibration, if one was provisioned for this device
+		wchar_t calibrationName[32];
+		swprintf_s(calibrationName, L"\\calibration\\%012llx.tcal", addr);
+		calibration.Open(std::wstring(Windows::Storage::ApplicationData::Current().LocalFolder().Path()) + calibrationName);
+
+		acquisition = AcquisitionPipeline::Create(executor, thermocamChr, [this](IBuffer value) { ProcessThermocamImageData(value); });
+		acquisition->Start();
+
 		/*
 		tokenForCharacteristicValueChanged = thermocamChr.ValueChanged({ this, &MainPage::OnThermocamImageUpdate });
 		GattCommunicationStatus status = co_await thermocamChr.WriteClientCharacteristicConfigurationDescriptorAsync(GattClientCharacteristicConfigurationDescriptorValue::Notify);
@@ -5,6 +5,19 @@
 #pragma once
 
 #include "MainPage.g.h"
+#include "acquisition.h"
+#include "agc.h"
+#include "calibration.h"
+#include "denoise.h"
+#include "executor.h"
+#include "fixedpoint.h"
+#include "framering.h"
+#include "frameserver.h"
+#include "history.h"
+#include "hotspot.h"
+#include "occupancy.h"
+#include "pyramid.h"
+#include "statistics.h"
 
 using namespace winrt;
 using namespace Windows::Devices::Bluetooth;
@@ -29,18 +42,25 @@ namespace winrt::viewer::implementation
     struct MainPage : MainPageT<MainPage>
     {
         MainPage();
+		~MainPage();
 
 		void NotifyUser(const std::wstring & strMessage, NotifyType type);
 
 
         void ClickHandler(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::RoutedEventArgs const& args);
+		void AnalyticsOnlyToggled(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::RoutedEventArgs const& args);
+		void AutoGainToggled(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::RoutedEventArgs const& args);
+		void FixedPointToggled(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::RoutedEventArgs const& args);
+		void StatisticsToggled(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::RoutedEventArgs const& args);
+		void StatisticSelected(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::Controls::SelectionChangedEventArgs const& args);
+		void WindowSelected(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::Controls::SelectionChangedEventArgs const& args);
+		void RewindChanged(Windows::Foundation::IInspectable const& sender, Windows::UI::Xaml::Controls::Primitives::RangeBaseValueChangedEventArgs const& args);
 		void OnAdvertisementReceived(BluetoothLEAdvertisementWatcher watcher, BluetoothLEAdvertisementReceivedEventArgs eventArgs);
 		void OnAdvertisementStopped(BluetoothLEAdvertisementWatcher watcher, BluetoothLEAdvertisementWatcherStoppedEventArgs eventArgs);
 		void OnBLEConnectionStatusChanged(BluetoothLEDevice device, IInspectable object);
 		void OnBLEGattServicesChanged(BluetoothLEDevice device, IInspectable object);
 		void OnBLENameChanged(BluetoothLEDevice device, IInspectable object);
 		void OnThermocamImageUpdate(GattCharacteristic chr, GattValueChangedEventArgs eventArgs);
-		void OnGrabImageTime(ThreadPoolTimer timer);
 
 		void DisconnectBLE();
 		void StopAdvWatcher();
@@ -51,6 +71,7 @@ namespace winrt::viewer::implementation
 		void UpdateStatus(const std::wstring & strMessage, NotifyType type);
 		IAsyncAction SubscribeToThermocamImagesAsync(const uint64_t addr);
 		void ProcessThermocamImageData(IBuffer data);
+		void OnViewportChanged();
 
 		bool seekConnection;
 		BluetoothLEAdvertisementWatcher advWatcher;
@@ -61,9 +82,15 @@ namespace winrt::viewer::implementation
 		BluetoothLEDevice client;
 		GattCharacteristic thermocamChr;
 		SoftwareBitmapSource thermocamBitmap;
+		SensorCalibration calibration;
 
-		ThreadPoolTimer imageGrabberTimestamp;
-		std::mutex grabberLock;
+		std::shared_ptr<AcquisitionPipeline> acquisition;
+		FrameServer frameServer; // publishes the frames to other processes
+		FrameRingWriter frameRing; // ... and to processes on this machine, through shared memory
+
+		// size of the image element in physical pixels, the image is rendered at the resolution it is displayed at
+		std::atomic<int> viewportWidth;
+		std::atomic<int> viewportHeight;
 
 		DisplayRequest displayRequest;
 		std::atomic<uint32_t> requestCount;
@@ -73,9 +100,32 @@ namespace winrt::viewer::implementation
 		event_token tokenForNameChanged;
 		event_token tokenForCharacteristicValueChanged;
 
+		// per stream state, reset by the image processing thread when streamResetPending is set on disconnect
+		std::atomic<bool> streamResetPending;
+		SensorGeometry geometry;
+		TemporalDenoiser denoiser;
+		FrameHistory history; // recent frames, for rewinding the live view
+		PixelStatistics statistics;
+		ZoomPyramid pyramid;
+		HotspotTracker hotspots;
+		OccupancyDetector occupancy;
+		// the options below are set from the options panel through the executor, and are read by the image processing only
+		bool analyticsOnly; // run presence detection only, skipping resampling and colorizing
+		bool autoGain; // colorize through the equalized histogram instead of linearly between min and max
+		AutoGainControl agc;
+		bool fixedPoint; // resample and colorize with integers only, for hosts without fast floating point
+		bool showStatistics; // display a statistic of the recent frames (e.g. max-hold) instead of the live frame
+		PixelStatistic displayStatistic;
+		StatisticsWindow displayWindow;
+		double rewindSeconds; // display the frame this long before the latest one, from the history
+
 		std::vector<uint32_t> colorScale;
 		float min;
 		float max;
+
+		// image processing of all devices. Declared last, so it is destroyed
+		// before the state its work items use
+		Executor executor;
 	};
 }
 
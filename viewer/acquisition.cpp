@@ -0,0 +1,219 @@
+#include "pch.h"
+#include "acquisition.h"
+#include "decode.h"
+#include "executor.h"
+
+using namespace winrt;
+using namespace Windows::Devices::Bluetooth;
+using namespace Windows::Devices::Bluetooth::GenericAttributeProfile;
+using namespace Windows::Foundation;
+using namespace Windows::Storage::Streams;
+using namespace Windows::System::Threading;
+
+std::shared_ptr<AcquisitionPipeline> AcquisitionPipeline::Create(Executor & executor, GattCharacteristic characteristic,
+	FrameHandler handler, const AcquisitionParams & params)
+{
+	return std::shared_ptr<AcquisitionPipeline>(new AcquisitionPipeline(executor, characteristic, std::move(handler), params));
+}
+
+AcquisitionPipeline::AcquisitionPipeline(Executor & executor, GattCharacteristic characteristic,
+	FrameHandler handler, const AcquisitionParams & params) :
+	executor(executor), characteristic(characteristic), handler(std::move(handler)), params(params),
+	stopping(false), sensorPeriod(params.period), hasLastFrame(false), duplicateSinceLastFrame(false), lastFingerprint(0),
+	pendingRead(nullptr), pendingFrame(nullptr), processing(false)
+{
+	stats.sensorPeriodUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(sensorPeriod).count());
+}
+
+void AcquisitionPipeline::Start()
+{
+	Acquire();
+}
+
+void AcquisitionPipeline::Stop()
+{
+	stopping = true;
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (pendingRead) {
+		pendingRead.Cancel();
+	}
+	pendingFrame = nullptr;
+}
+
+IAsyncAction AcquisitionPipeline::Acquire()
+{
+	auto self = shared_from_this();
+	auto next = Clock::now();
+
+	while (!stopping) {
+		const auto started = Clock::now();
+		IBuffer value = co_await Read();
+		bool fresh = false;
+		if (value) {
+			fresh = IsNewFrame(value, started);
+			if (fresh) {
+				Submit(value, started);
+			}
+			else {
+				++stats.duplicates;
+			}
+		}
+
+		const auto now = Clock::now();
+		const Clock::duration step = params.adaptivePacing ? sensorPeriod : params.period;
+		if (params.adaptivePacing && value) {
+			// creep earlier by a sixteenth of a period per frame until a read
+			// comes too early, then retry after an eighth
+			next = fresh ? started + sensorPeriod - sensorPeriod / 16 : now + sensorPeriod / 8;
+		}
+		else {
+			next += step;
+		}
+
+		// a late read skips the missed slots instead of reading back to back
+		while (next <= now) {
+			next += step;
+		}
+		co_await resume_after(std::chrono::duration_cast<TimeSpan>(next - now));
+	}
+}
+
+bool AcquisitionPipeline::IsNewFrame(IBuffer value, const Clock::time_point started)
+{
+	std::vector<uint8_t> data(value.Length());
+	DataReader::FromBuffer(value).ReadBytes(data);
+	const ThermocamFingerprint fingerprint = thermocamFrameFingerprint(data.data(), data.size());
+	if (hasLastFrame && fingerprint.value == lastFingerprint) {
+		duplicateSinceLastFrame = true;
+		return false;
+	}
+
+	if (hasLastFrame) {
+		// frames since the last new one: known from sequence numbers, one
+		// if the last one was read again in between, otherwise guessed from
+		// the current estimate
+		const auto interval = started - lastFrameStarted;
+		const int64_t frames = fingerprint.hasSequence ? static_cast<int64_t>(static_cast<uint32_t>(fingerprint.value - lastFingerprint)) :
+			duplicateSinceLastFrame ? 1 : std::max<int64_t>(1, (interval + sensorPeriod / 2) / sensorPeriod);
+		if (frames >= 1 && frames <= 16) {
+			sensorPeriod += (interval / frames - sensorPeriod) / 8;
+			sensorPeriod = std::min<Clock::duration>(std::max<Clock::duration>(sensorPeriod, params.period / 8), params.period * 16);
+			stats.sensorPeriodUs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(sensorPeriod).count());
+		}
+	}
+
+	hasLastFrame = true;
+	duplicateSinceLastFrame = false;
+	lastFingerprint = fingerprint.value;
+	lastFrameStarted = started;
+	return true;
+}
+
+IAsyncOperation<IBuffer> AcquisitionPipeline::Read()
+{
+	auto self = shared_from_this();
+
+	auto read = characteristic.ReadValueAsync(BluetoothCacheMode::Uncached);
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (stopping) {
+			read.Cancel();
+		}
+		pendingRead = read;
+	}
+
+	// the deadline cancels the read from a timer, nothing waits for it
+	auto timedOut = std::make_shared<std::atomic<bool>>(false);
+	ThreadPoolTimer deadline = ThreadPoolTimer::CreateTimer([read, timedOut](ThreadPoolTimer) {
+		*timedOut = true;
+		read.Cancel();
+	}, params.readTimeout);
+
+	IBuffer value{ nullptr };
+	try {
+		GattReadResult result = co_await read;
+		if (result.Status() == GattCommunicationStatus::Success) {
+			value = result.Value();
+		}
+		else {
+			++stats.readFailures;
+		}
+	}
+	catch (hresult_error const &) {
+		if (*timedOut) {
+			++stats.readTimeouts;
+		}
+		else if (!stopping) {
+			++stats.readFailures;
+		}
+	}
+	deadline.Cancel();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		pendingRead = nullptr;
+	}
+	co_return value;
+}
+
+void AcquisitionPipeline::Submit(IBuffer value, const Clock::time_point started)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (stopping) {
+		return;
+	}
+	if (pendingFrame) {
+		++stats.dropped; // processing is behind, keep the latest frame only
+	}
+	pendingFrame = value;
+	pendingStarted = started;
+
+	if (!processing) {
+		processing = true;
+		Process();
+	}
+}
+
+fire_and_forget AcquisitionPipeline::Process()
+{
+	auto self = shared_from_this();
+	co_await executor.Schedule();
+
+	for (;;) {
+		IBuffer frame{ nullptr };
+		Clock::time_point started;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			if (!pendingFrame) {
+				processing = false;
+				co_return;
+			}
+			frame = pendingFrame;
+			started = pendingStarted;
+			pendingFrame = nullptr;
+		}
+
+		const auto now = Clock::now();
+		if (now - started > params.maxLatency) {
+			++stats.dropped;
+			continue;
+		}
+
+		// a frame that fails to process must not stop the pipeline, processing
+		// would stay flagged and no later frame would be scheduled
+		try {
+			handler(frame);
+			++stats.frames;
+		}
+		catch (hresult_error const &) {
+			++stats.handlerFailures;
+		}
+		catch (std::exception const &) {
+			++stats.handlerFailures;
+		}
+		if (Clock::now() - now > params.period) {
+			++stats.overruns;
+		}
+	}
+}
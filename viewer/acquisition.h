@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+class Executor;
+
+// Periodic acquisition of the thermal image of one device, as a chain of
+// coroutines:
+//
+//   acquire:  wait for the frame slot, read the characteristic
+//   process:  decode and render the frame on the executor
+//   present:  done by the frame handler, posting to the UI dispatcher
+//
+// The stages are pipelined: the next frame is read while the previous one
+// is processed. If processing falls behind, only the most recent frame is
+// kept. Reads are cancelled once they exceed their deadline, frames older
+// than the latency budget are dropped instead of processed.
+//
+// Frames already read are recognized by their sequence number or a hash,
+// and skipped before decoding. With adaptive pacing, reads follow the
+// sensor instead of a fixed grid: the sensor period is estimated from the
+// new frames, and every read after a new frame is scheduled a little
+// earlier than one period later. Once a read comes too early and finds the
+// same frame, it is retried shortly after, so reads stay locked just after
+// the sensor's refreshes however the two clocks drift.
+
+struct AcquisitionParams
+{
+	std::chrono::milliseconds period{ 100 };
+	std::chrono::milliseconds readTimeout{ 500 };
+	std::chrono::milliseconds maxLatency{ 300 }; // from the start of the read to the start of processing
+	bool adaptivePacing = true; // follow the sensor's refreshes, period being the initial estimate
+};
+
+struct AcquisitionStats
+{
+	std::atomic<uint32_t> frames{ 0 };
+	std::atomic<uint32_t> readFailures{ 0 };
+	std::atomic<uint32_t> readTimeouts{ 0 };
+	std::atomic<uint32_t> dropped{ 0 };  // superseded or too old
+	std::atomic<uint32_t> overruns{ 0 }; // processing took longer than the period
+	std::atomic<uint32_t> duplicates{ 0 }; // frames read again, not processed
+	std::atomic<uint32_t> handlerFailures{ 0 }; // the frame handler threw, the pipeline went on with the next frame
+	std::atomic<uint32_t> sensorPeriodUs{ 0 }; // estimated
+};
+
+class AcquisitionPipeline : public std::enable_shared_from_this<AcquisitionPipeline>
+{
+public:
+	// Runs on the executor.
+	using FrameHandler = std::function<void(winrt::Windows::Storage::Streams::IBuffer)>;
+
+	static std::shared_ptr<AcquisitionPipeline> Create(Executor & executor,
+		winrt::Windows::Devices::Bluetooth::GenericAttributeProfile::GattCharacteristic characteristic,
+		FrameHandler handler, const AcquisitionParams & params = AcquisitionParams());
+
+	void Start();
+
+	// Cancels the pending read and stops after the frame being processed, if
+	// any. Does not block, the coroutines keep the pipeline alive until they
+	// have finished.
+	void Stop();
+
+	const AcquisitionStats & Stats() const { return stats; }
+
+private:
+	using Clock = std::chrono::steady_clock;
+
+	AcquisitionPipeline(Executor & executor,
+		winrt::Windows::Devices::Bluetooth::GenericAttributeProfile::GattCharacteristic characteristic,
+		FrameHandler handler, const AcquisitionParams & params);
+
+	winrt::Windows::Foundation::IAsyncAction Acquire();
+	winrt::Windows::Foundation::IAsyncOperation<winrt::Windows::Storage::Streams::IBuffer> Read();
+	bool IsNewFrame(winrt::Windows::Storage::Streams::IBuffer value, Clock::time_point started);
+	void Submit(winrt::Windows::Storage::Streams::IBuffer value, Clock::time_point started);
+	winrt::fire_and_forget Process();
+
+	Executor & executor;
+	winrt::Windows::Devices::Bluetooth::GenericAttributeProfile::GattCharacteristic characteristic;
+	FrameHandler handler;
+	AcquisitionParams params;
+	AcquisitionStats stats;
+	std::atomic<bool> stopping;
+
+	// pacing state, used by Acquire only
+	Clock::duration sensorPeriod;
+	bool hasLastFrame;
+	bool duplicateSinceLastFrame;
+	uint64_t lastFingerprint;
+	Clock::time_point lastFrameStarted;
+
+	std::mutex lock; // guards the members below
+	winrt::Windows::Foundation::IAsyncOperation<winrt::Windows::Devices::Bluetooth::GenericAttributeProfile::GattReadResult> pendingRead;
+	winrt::Windows::Storage::Streams::IBuffer pendingFrame;
+	Clock::time_point pendingStarted;
+	bool processing;
+};
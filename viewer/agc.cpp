@@ -0,0 +1,103 @@
+#include "pch.h"
+#include "agc.h"
+
+static const int bins = 256;
+
+AutoGainControl::AutoGainControl(const AgcParams & params) : params(params), histogram(bins), mapping(bins), table(bins),
+	low(0), high(0), initialized(false)
+{
+}
+
+void AutoGainControl::SetParams(const AgcParams & newParams)
+{
+	params = newParams;
+	Reset();
+}
+
+void AutoGainControl::Reset()
+{
+	initialized = false;
+}
+
+// An odd stride, so the sample does not fall on the same columns of every
+// row of the field.
+static size_t sampleStride(const size_t count, const size_t samples)
+{
+	return std::max<size_t>(1, count / std::max<size_t>(1, samples)) | 1;
+}
+
+void AutoGainControl::Update(const float * field, const size_t count, const uint32_t * palette)
+{
+	values.clear();
+	for (size_t i = 0; i < count; i += sampleStride(count, params.samples)) {
+		values.push_back(field[i]);
+	}
+	Build(palette);
+}
+
+void AutoGainControl::Update(const FixedTemperature * field, const size_t count, const uint32_t * palette)
+{
+	values.clear();
+	for (size_t i = 0; i < count; i += sampleStride(count, params.samples)) {
+		values.push_back(fromFixedTemperature(field[i]));
+	}
+	Build(palette);
+}
+
+void AutoGainControl::Build(const uint32_t * palette)
+{
+	if (values.empty()) {
+		return;
+	}
+
+	const auto minmax = std::minmax_element(values.begin(), values.end());
+	float frameLow = *minmax.first;
+	float frameHigh = *minmax.second;
+	if (frameHigh - frameLow < params.minRange) {
+		const float center = (frameLow + frameHigh) / 2;
+		frameLow = center - params.minRange / 2;
+		frameHigh = center + params.minRange / 2;
+	}
+
+	// the mapping of the previous frame is for its range, so the range is
+	// smoothed first and the new histogram binned on the smoothed one
+	if (initialized) {
+		low += params.smoothing * (frameLow - low);
+		high += params.smoothing * (frameHigh - high);
+	}
+	else {
+		low = frameLow;
+		high = frameHigh;
+	}
+
+	std::fill(histogram.begin(), histogram.end(), 0.0f);
+	const float scale = bins / (high - low);
+	for (const float v : values) {
+		const int bin = static_cast<int>((v - low) * scale);
+		histogram[bin < 0 ? 0 : (bin >= bins ? bins - 1 : bin)]++;
+	}
+
+	float total = 0;
+	if (params.plateau > 0) {
+		const float limit = std::max(1.0f, params.plateau * values.size() / bins);
+		for (float & h : histogram) {
+			h = std::min(h, limit);
+			total += h;
+		}
+	}
+	else {
+		total = static_cast<float>(values.size());
+	}
+
+	// each bin maps to the middle of its share of the cumulative histogram
+	float cumulative = 0;
+	for (int b = 0; b < bins; ++b) {
+		const float equalized = (cumulative + histogram[b] / 2) / total * (bins - 1);
+		const float linear = static_cast<float>(b);
+		const float target = params.linearShare * linear + (1 - params.linearShare) * equalized;
+		mapping[b] = initialized ? mapping[b] + params.smoothing * (target - mapping[b]) : target;
+		cumulative += histogram[b];
+		table[b] = palette[static_cast<int>(mapping[b] + 0.5f)];
+	}
+	initialized = true;
+}
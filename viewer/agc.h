@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "fixedpoint.h"
+
+// Automatic gain control for colorizing: instead of spreading the palette
+// linearly between the coldest and hottest pixel, which leaves most of it
+// unused when a single hot object is in view, temperatures are mapped
+// through the equalized histogram of the frame.
+//
+// The histogram is built from a sparse sample of the field, its bins are
+// clipped at a plateau so large uniform areas (walls, sky) don't take over
+// the palette, and its cumulative sum is blended with the linear mapping.
+// The result is folded into a 256 color table spaced linearly between the
+// low and high temperature, so colorizing still is one lookup per pixel,
+// through the same code as the linear mapping with the table in place of
+// the palette.
+//
+// Range and mapping are smoothed over frames, so the image does not
+// flicker as objects move.
+
+struct AgcParams
+{
+	float plateau = 4.0f;       // bin count limit, in multiples of the mean bin count, 0 = plain equalization
+	float linearShare = 0.25f;  // weight of the linear mapping blended in
+	float smoothing = 0.2f;     // weight of the new frame, 1 = no smoothing
+	float minRange = 2.0f;      // degC, flat scenes are not stretched beyond this
+	size_t samples = 1024;      // values taken from the field per frame
+};
+
+class AutoGainControl
+{
+public:
+	explicit AutoGainControl(const AgcParams & params = AgcParams());
+
+	void SetParams(const AgcParams & params);
+	const AgcParams & Params() const { return params; }
+	void Reset();
+
+	// palette: 256 colors
+	void Update(const float * field, size_t count, const uint32_t * palette);
+	void Update(const FixedTemperature * field, size_t count, const uint32_t * palette);
+
+	// Colors for temperatures from Low() to High(), linearly spaced.
+	const uint32_t * Table() const { return table.data(); }
+	float Low() const { return low; }
+	float High() const { return high; }
+
+private:
+	void Build(const uint32_t * palette);
+
+	AgcParams params;
+	std::vector<float> values;
+	std::vector<float> histogram;
+	std::vector<float> mapping; // palette index per bin, smoothed
+	std::vector<uint32_t> table;
+	float low;
+	float high;
+	bool initialized;
+};
@@ -0,0 +1,127 @@
+#include "pch.h"
+#include "calibration.h"
+#include "decode.h"
+
+#pragma pack(push, 1)
+struct CalibrationFileHeader
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t pixelCount;
+	float emissivity;
+	float reflectedTemperature;
+};
+#pragma pack(pop)
+
+SensorCalibration::SensorCalibration() : unit(0.25f), pixelCount(amg88xx_geometry.PixelCount()), lastWrite(0)
+{
+}
+
+void SensorCalibration::SetSensor(const SensorType & sensor)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	const float newUnit = pixelUnit(sensor.format);
+	const size_t newPixelCount = sensor.geometry.PixelCount();
+	if (newUnit == unit && newPixelCount == pixelCount) {
+		return;
+	}
+	unit = newUnit;
+	pixelCount = newPixelCount;
+	std::atomic_store(&coefficients, std::shared_ptr<const CalibrationCoefficients>());
+	if (!path.empty()) {
+		Load();
+	}
+}
+
+void SensorCalibration::Open(const std::wstring & newPath)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	path = newPath;
+	lastWrite = 0;
+	Load();
+}
+
+void SensorCalibration::Close()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	path.clear();
+	std::atomic_store(&coefficients, std::shared_ptr<const CalibrationCoefficients>());
+}
+
+void SensorCalibration::ReloadIfChanged()
+{
+	std::unique_lock<std::mutex> guard(lock, std::try_to_lock);
+	if (!guard.owns_lock() || path.empty()) {
+		return; // being opened or closed right now
+	}
+
+	const auto now = std::chrono::steady_clock::now();
+	if (now - lastCheck < std::chrono::seconds(1)) {
+		return;
+	}
+	lastCheck = now;
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &attributes)) {
+		return; // keep the last good calibration while the file is being replaced
+	}
+	const uint64_t written = (static_cast<uint64_t>(attributes.ftLastWriteTime.dwHighDateTime) << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	if (written != lastWrite) {
+		Load();
+	}
+}
+
+std::shared_ptr<const CalibrationCoefficients> SensorCalibration::Current() const
+{
+	return std::atomic_load(&coefficients);
+}
+
+void SensorCalibration::Load()
+{
+	winrt::handle file(CreateFile2(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, OPEN_EXISTING, nullptr));
+	if (file.get() == INVALID_HANDLE_VALUE) {
+		file.detach();
+		return;
+	}
+
+	FILE_BASIC_INFO info;
+	LARGE_INTEGER size;
+	if (!GetFileInformationByHandleEx(file.get(), FileBasicInfo, &info, sizeof info) || !GetFileSizeEx(file.get(), &size)) {
+		return;
+	}
+	lastWrite = info.LastWriteTime.QuadPart;
+
+	const size_t expected = sizeof(CalibrationFileHeader) + 2 * pixelCount * sizeof(float);
+	if (static_cast<uint64_t>(size.QuadPart) < expected) {
+		return;
+	}
+
+	winrt::handle mapping(CreateFileMappingFromApp(file.get(), nullptr, PAGE_READONLY, 0, nullptr));
+	if (!mapping) {
+		return;
+	}
+	const void * view = MapViewOfFileFromApp(mapping.get(), FILE_MAP_READ, 0, 0);
+	if (!view) {
+		return;
+	}
+
+	const auto * header = static_cast<const CalibrationFileHeader *>(view);
+	const auto * gain = reinterpret_cast<const float *>(header + 1);
+	const auto * offset = gain + pixelCount;
+	const float e = header->emissivity;
+
+	if (memcmp(header->magic, "TCAL", 4) == 0 && header->version == 1 && header->pixelCount == pixelCount && e > 0 && e <= 1) {
+		auto c = std::make_shared<CalibrationCoefficients>();
+		c->unit = unit;
+		c->scale.resize(pixelCount);
+		c->offset.resize(pixelCount);
+		const float reflected = (1 - e) * header->reflectedTemperature;
+		for (size_t i = 0; i < pixelCount; ++i) {
+			c->scale[i] = unit * gain[i] / e;
+			c->offset[i] = (offset[i] - reflected) / e;
+		}
+		std::atomic_store(&coefficients, std::shared_ptr<const CalibrationCoefficients>(std::move(c)));
+	}
+
+	UnmapViewOfFile(view);
+}
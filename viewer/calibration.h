@@ -0,0 +1,67 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "geometry.h"
+
+// Per sensor calibration: pixel gain and offset errors, and the emissivity
+// of the scene at the installation.
+//
+// Tables live in a small binary file per device (all values little endian):
+//
+//   char     magic[4]          "TCAL"
+//   uint16   version           1
+//   uint16   pixel_count       of the sensor, 64 for the AMG88xx
+//   float    emissivity        0 < e <= 1
+//   float    reflected_temp    degC, background reflected by the scene
+//   float    gain[pixel_count]
+//   float    offset[pixel_count] degC
+//
+// corrected = (gain * measured + offset - (1 - e) * reflected_temp) / e
+//
+// The emissivity correction is the linearized one, good for emissivities
+// close to 1. All terms, including the unit of the sensor's pixel format,
+// are folded into one scale and offset per pixel, applied by the decoder.
+
+struct CalibrationCoefficients
+{
+	float unit;                // degC per raw sensor unit the scale was made for
+	std::vector<float> scale;  // degC per raw sensor unit
+	std::vector<float> offset; // degC
+};
+
+class SensorCalibration
+{
+public:
+	SensorCalibration();
+
+	// Maps the file and derives the coefficients. A missing or invalid file
+	// leaves the sensor uncalibrated; it is picked up once it appears.
+	void Open(const std::wstring & path);
+	void Close();
+
+	// The sensor the tables are for, reloads them if it changed. Tables for
+	// a different pixel count are rejected. AMG88xx until set.
+	void SetSensor(const SensorType & sensor);
+
+	// Reloads the file if it changed on disk. Checks at most once a second,
+	// so it is cheap enough to call on every frame.
+	void ReloadIfChanged();
+
+	// nullptr if uncalibrated. Safe to call from any thread.
+	std::shared_ptr<const CalibrationCoefficients> Current() const;
+
+private:
+	void Load();
+
+	std::mutex lock; // guards everything but coefficients
+	std::wstring path;
+	float unit;
+	size_t pixelCount;
+	uint64_t lastWrite;
+	std::chrono::steady_clock::time_point lastCheck;
+	std::shared_ptr<const CalibrationCoefficients> coefficients; // atomic access only
+};
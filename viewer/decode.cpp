@@ -0,0 +1,93 @@
+#include "pch.h"
+#include "decode.h"
+#include "calibration.h"
+
+static uint32_t readLe32(const uint8_t * p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// 12 bit two's complement
+static int16_t signExtend12(const uint16_t pixel)
+{
+	return static_cast<int16_t>((pixel & 0x07ff) - (pixel & 0x0800));
+}
+
+float pixelUnit(const PixelFormat format)
+{
+	return format == PixelFormat::Amg88xx ? 0.25f : 0.01f;
+}
+
+bool decodeThermocamImage(const uint8_t * data, const size_t length, const SensorType & sensor, float * temperatures,
+	const CalibrationCoefficients * calibration, ThermocamFrameInfo * info)
+{
+	const size_t pixel_count = sensor.geometry.PixelCount();
+	const size_t raw_size = payloadSize(sensor, false);
+	const size_t packed_size = payloadSize(sensor, true);
+
+	const bool raw = length == raw_size || length == raw_size + trailer_size;
+	const bool packed = !raw && (length == packed_size || length == packed_size + trailer_size);
+	if (!packed && !raw) {
+		return false;
+	}
+
+	// pixel values in the units of the format first, scaled in place below
+	if (sensor.format == PixelFormat::Centidegree16) {
+		for (size_t i = 0; i < pixel_count; ++i) {
+			temperatures[i] = static_cast<int16_t>(data[i * 2] | (data[i * 2 + 1] << 8));
+		}
+	}
+	else if (raw) {
+		for (size_t i = 0; i < pixel_count; ++i) {
+			temperatures[i] = signExtend12(data[i * 2] | (data[i * 2 + 1] << 8));
+		}
+	}
+	else {
+		for (size_t i = 0; i < pixel_count; i += 2) {
+			const uint8_t * p = data + i / 2 * 3;
+			temperatures[i] = signExtend12(p[0] | ((p[1] & 0x0f) << 8));
+			if (i + 1 < pixel_count) {
+				temperatures[i + 1] = signExtend12((p[1] >> 4) | (p[2] << 4));
+			}
+		}
+	}
+
+	// calibration folds the unit of the format into its gain
+	const float unit = pixelUnit(sensor.format);
+	if (calibration && calibration->unit == unit && calibration->scale.size() == pixel_count) {
+		const float * scale = calibration->scale.data();
+		const float * offset = calibration->offset.data();
+		for (size_t i = 0; i < pixel_count; ++i) {
+			temperatures[i] = temperatures[i] * scale[i] + offset[i];
+		}
+	}
+	else {
+		for (size_t i = 0; i < pixel_count; ++i) {
+			temperatures[i] *= unit;
+		}
+	}
+
+	if (info) {
+		const size_t payload = raw ? raw_size : packed_size;
+		info->hasSequence = length == payload + trailer_size;
+		if (info->hasSequence) {
+			info->sequence = readLe32(data + payload);
+			info->timestampMs = readLe32(data + payload + 4);
+		}
+	}
+	return true;
+}
+
+ThermocamFingerprint thermocamFrameFingerprint(const uint8_t * data, const size_t length)
+{
+	const SensorType * sensor = sensorForPayload(length);
+	if (sensor && (length == payloadSize(*sensor, false) + trailer_size || length == payloadSize(*sensor, true) + trailer_size)) {
+		return ThermocamFingerprint{ readLe32(data + length - trailer_size), true };
+	}
+
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < length; ++i) {
+		hash = (hash ^ data[i]) * 1099511628211ull;
+	}
+	return ThermocamFingerprint{ hash, false };
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "geometry.h"
+
+struct CalibrationCoefficients;
+
+// Decoding of the thermal image characteristic value. The payload holds
+// the pixels of the sensor in its PixelFormat, optionally followed by the
+// frame sequence number and capture time. AMG88xx pixels are either the raw
+// registers (64 x 16 bit) or packed into 3 bytes per pixel pair.
+
+struct ThermocamFrameInfo
+{
+	bool hasSequence = false;
+	uint32_t sequence = 0;
+	uint32_t timestampMs = 0; // capture time, ms since the sensor booted
+};
+
+// Degrees C per unit of the pixel format.
+float pixelUnit(PixelFormat format);
+
+// Writes sensor.geometry.PixelCount() temperatures in degC. Per pixel
+// calibration, if given and made for this sensor, is applied in the same
+// pass. Returns false if the payload size does not match the sensor.
+bool decodeThermocamImage(const uint8_t * data, size_t length, const SensorType & sensor, float * temperatures,
+	const CalibrationCoefficients * calibration, ThermocamFrameInfo * info);
+
+// Identifies a frame for duplicate detection: the sequence number of the
+// trailer if the frame has one, otherwise a 64 bit FNV-1a hash of the whole
+// value, which only tells frames apart.
+struct ThermocamFingerprint
+{
+	uint64_t value;
+	bool hasSequence;
+};
+
+ThermocamFingerprint thermocamFrameFingerprint(const uint8_t * data, size_t length);
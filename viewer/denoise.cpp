@@ -0,0 +1,176 @@
+#include "pch.h"
+#include "denoise.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define DENOISE_SSE2
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define DENOISE_NEON
+#endif
+
+TemporalDenoiser::TemporalDenoiser(const size_t pixelCount, const DenoiseParams & params) :
+	params(params), estimate(pixelCount, 0.0f), variance(pixelCount, 0.0f), initialized(pixelCount, false)
+{
+}
+
+void TemporalDenoiser::SetParams(const DenoiseParams & newParams)
+{
+	params = newParams;
+	Reset();
+}
+
+void TemporalDenoiser::Reset()
+{
+	std::fill(initialized.begin(), initialized.end(), false);
+}
+
+// Scalar versions of the update steps, these define the filter. The vector
+// versions below do the same operations in the same order, without fused
+// multiply-adds, so they produce the same results. The exception is 32 bit
+// ARM, which has no vector division: its Kalman gain comes from a refined
+// reciprocal estimate, within a few ulp of the scalar one.
+
+static inline float emaStep(float & x, const float z, const float alpha)
+{
+	x += alpha * (z - x);
+	return x;
+}
+
+static inline float kalmanStep(float & x, float & p, const float z, const float q, const float r, const float resetThreshold)
+{
+	if (std::abs(z - x) > resetThreshold) {
+		x = z;
+		p = r;
+		return x;
+	}
+	p += q;
+	const float k = p / (p + r);
+	x += k * (z - x);
+	p -= k * p;
+	return x;
+}
+
+static void emaSpan(float * x, const float * z, float * out, const size_t n, const float alpha)
+{
+	size_t i = 0;
+#if defined(DENOISE_SSE2)
+	const __m128 va = _mm_set1_ps(alpha);
+	for (; i + 4 <= n; i += 4) {
+		__m128 vx = _mm_loadu_ps(x + i);
+		vx = _mm_add_ps(vx, _mm_mul_ps(va, _mm_sub_ps(_mm_loadu_ps(z + i), vx)));
+		_mm_storeu_ps(x + i, vx);
+		_mm_storeu_ps(out + i, vx);
+	}
+#elif defined(DENOISE_NEON)
+	const float32x4_t va = vdupq_n_f32(alpha);
+	for (; i + 4 <= n; i += 4) {
+		float32x4_t vx = vld1q_f32(x + i);
+		vx = vaddq_f32(vx, vmulq_f32(va, vsubq_f32(vld1q_f32(z + i), vx)));
+		vst1q_f32(x + i, vx);
+		vst1q_f32(out + i, vx);
+	}
+#endif
+	for (; i < n; ++i) {
+		out[i] = emaStep(x[i], z[i], alpha);
+	}
+}
+
+static void kalmanSpan(float * x, float * p, const float * z, float * out, const size_t n,
+	const float q, const float r, const float resetThreshold)
+{
+	size_t i = 0;
+#if defined(DENOISE_SSE2)
+	const __m128 vq = _mm_set1_ps(q);
+	const __m128 vr = _mm_set1_ps(r);
+	const __m128 vt = _mm_set1_ps(resetThreshold);
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+	for (; i + 4 <= n; i += 4) {
+		const __m128 vz = _mm_loadu_ps(z + i);
+		__m128 vx = _mm_loadu_ps(x + i);
+		__m128 vp = _mm_add_ps(_mm_loadu_ps(p + i), vq);
+		const __m128 innovation = _mm_sub_ps(vz, vx);
+		const __m128 k = _mm_div_ps(vp, _mm_add_ps(vp, vr));
+		vx = _mm_add_ps(vx, _mm_mul_ps(k, innovation));
+		vp = _mm_sub_ps(vp, _mm_mul_ps(k, vp));
+		// select the reset state where the change is over the threshold
+		const __m128 reset = _mm_cmpgt_ps(_mm_and_ps(innovation, absMask), vt);
+		vx = _mm_or_ps(_mm_and_ps(reset, vz), _mm_andnot_ps(reset, vx));
+		vp = _mm_or_ps(_mm_and_ps(reset, vr), _mm_andnot_ps(reset, vp));
+		_mm_storeu_ps(x + i, vx);
+		_mm_storeu_ps(p + i, vp);
+		_mm_storeu_ps(out + i, vx);
+	}
+#elif defined(DENOISE_NEON)
+	const float32x4_t vq = vdupq_n_f32(q);
+	const float32x4_t vr = vdupq_n_f32(r);
+	const float32x4_t vt = vdupq_n_f32(resetThreshold);
+	for (; i + 4 <= n; i += 4) {
+		const float32x4_t vz = vld1q_f32(z + i);
+		float32x4_t vx = vld1q_f32(x + i);
+		float32x4_t vp = vaddq_f32(vld1q_f32(p + i), vq);
+		const float32x4_t innovation = vsubq_f32(vz, vx);
+		const float32x4_t s = vaddq_f32(vp, vr);
+#if defined(_M_ARM64) || defined(__aarch64__)
+		const float32x4_t k = vdivq_f32(vp, s);
+#else
+		// reciprocal estimate refined twice
+		float32x4_t inv = vrecpeq_f32(s);
+		inv = vmulq_f32(inv, vrecpsq_f32(s, inv));
+		inv = vmulq_f32(inv, vrecpsq_f32(s, inv));
+		const float32x4_t k = vmulq_f32(vp, inv);
+#endif
+		vx = vaddq_f32(vx, vmulq_f32(k, innovation));
+		vp = vsubq_f32(vp, vmulq_f32(k, vp));
+		const uint32x4_t reset = vcgtq_f32(vabsq_f32(innovation), vt);
+		vx = vbslq_f32(reset, vz, vx);
+		vp = vbslq_f32(reset, vr, vp);
+		vst1q_f32(x + i, vx);
+		vst1q_f32(p + i, vp);
+		vst1q_f32(out + i, vx);
+	}
+#endif
+	for (; i < n; ++i) {
+		out[i] = kalmanStep(x[i], p[i], z[i], q, r, resetThreshold);
+	}
+}
+
+void TemporalDenoiser::Filter(const float * input, float * output, const size_t offset, const size_t count)
+{
+	assert(offset + count <= estimate.size());
+
+	if (params.mode == DenoiseMode::None) {
+		std::copy(input, input + count, output);
+		return;
+	}
+
+	// the first frame seen by a pixel initializes its state
+	for (size_t i = 0; i < count; ++i) {
+		if (!initialized[offset + i]) {
+			estimate[offset + i] = input[i];
+			variance[offset + i] = params.measurementNoise;
+			initialized[offset + i] = true;
+		}
+	}
+
+	float * const x = estimate.data() + offset;
+	float * const p = variance.data() + offset;
+	switch (params.mode) {
+	case DenoiseMode::Ema:
+		emaSpan(x, input, output, count, params.emaAlpha);
+		break;
+	case DenoiseMode::Kalman:
+		kalmanSpan(x, p, input, output, count, params.processNoise, params.measurementNoise, INFINITY);
+		break;
+	case DenoiseMode::MotionAdaptive:
+		kalmanSpan(x, p, input, output, count, params.processNoise, params.measurementNoise, params.motionThreshold);
+		break;
+	default:
+		break;
+	}
+}
+
+void TemporalDenoiser::Filter(std::vector<float> & samples)
+{
+	Filter(samples.data(), samples.data(), 0, samples.size());
+}
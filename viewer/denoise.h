@@ -0,0 +1,47 @@
+#pragma once
+
+#include <vector>
+
+// Temporal noise filter working on the source samples of the sensor, before
+// resampling. The AMG88xx has roughly +-0.5 degC frame to frame noise per
+// pixel, filtering it at 8x8 is much cheaper than on the scaled image.
+//
+// State is kept per pixel in flat arrays, so several sensors can be filtered
+// in one pass by laying out their frames next to each other.
+
+enum class DenoiseMode
+{
+	None,
+	Ema,            // exponential moving average
+	Kalman,         // per pixel scalar Kalman filter
+	MotionAdaptive, // Kalman filter, reset on large changes
+};
+
+struct DenoiseParams
+{
+	DenoiseMode mode = DenoiseMode::MotionAdaptive;
+	float emaAlpha = 0.3f;          // weight of the new sample in Ema mode
+	float processNoise = 0.01f;     // expected variance of the real temperature change per frame
+	float measurementNoise = 0.09f; // variance of the sensor noise (0.3 degC std dev)
+	float motionThreshold = 1.5f;   // change in degC which resets a pixel in MotionAdaptive mode
+};
+
+class TemporalDenoiser
+{
+public:
+	explicit TemporalDenoiser(size_t pixelCount = 64, const DenoiseParams & params = DenoiseParams());
+
+	void SetParams(const DenoiseParams & params);
+	const DenoiseParams & Params() const { return params; }
+	void Reset();
+
+	// Filters count samples starting at pixel offset, in place is allowed.
+	void Filter(const float * input, float * output, size_t offset, size_t count);
+	void Filter(std::vector<float> & samples);
+
+private:
+	DenoiseParams params;
+	std::vector<float> estimate;
+	std::vector<float> variance;
+	std::vector<bool> initialized;
+};
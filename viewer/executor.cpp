@@ -0,0 +1,50 @@
+#include "pch.h"
+#include "executor.h"
+
+Executor::Executor() : stopping(false), thread(&Executor::Run, this)
+{
+}
+
+Executor::~Executor()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wakeup.notify_one();
+	thread.join();
+}
+
+void Executor::Post(std::function<void()> work)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		queue.push_back(std::move(work));
+	}
+	wakeup.notify_one();
+}
+
+void Executor::Drain()
+{
+	assert(!IsCurrent());
+	std::promise<void> done;
+	Post([&done] { done.set_value(); });
+	done.get_future().wait();
+}
+
+void Executor::Run()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;) {
+		wakeup.wait(guard, [this] { return stopping || !queue.empty(); });
+		if (queue.empty()) {
+			return; // stopping, and everything queued has run
+		}
+		auto work = std::move(queue.front());
+		queue.pop_front();
+
+		guard.unlock();
+		work();
+		guard.lock();
+	}
+}
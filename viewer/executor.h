@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <experimental/coroutine>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+
+// Runs work items and coroutine continuations in order on one dedicated
+// thread. Coroutines hop onto it with co_await executor.Schedule(), and
+// return to it after their asynchronous operations complete elsewhere, so
+// no thread is ever parked waiting for I/O. One executor can drive the
+// processing of many devices.
+
+class Executor
+{
+public:
+	Executor();
+	~Executor();
+	Executor(const Executor &) = delete;
+	Executor & operator=(const Executor &) = delete;
+
+	void Post(std::function<void()> work);
+
+	// Blocks until everything posted so far has run. Not from the
+	// executor's own thread.
+	void Drain();
+	bool IsCurrent() const { return std::this_thread::get_id() == thread.get_id(); }
+
+	auto Schedule()
+	{
+		struct Awaiter
+		{
+			Executor & executor;
+			bool await_ready() const { return executor.IsCurrent(); }
+			void await_suspend(std::experimental::coroutine_handle<> handle) { executor.Post(handle); }
+			void await_resume() const {}
+		};
+		return Awaiter{ *this };
+	}
+
+private:
+	void Run();
+
+	std::mutex lock;
+	std::condition_variable wakeup;
+	std::deque<std::function<void()>> queue;
+	bool stopping;
+	std::thread thread;
+};
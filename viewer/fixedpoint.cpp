@@ -0,0 +1,182 @@
+#include "pch.h"
+#include "fixedpoint.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define FIXEDPOINT_SSE2
+#elif defined(_M_ARM) || defined(_M_ARM64) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FIXEDPOINT_NEON
+#endif
+
+static inline int16_t saturate16(const int32_t v)
+{
+	return static_cast<int16_t>(v < INT16_MIN ? INT16_MIN : (v > INT16_MAX ? INT16_MAX : v));
+}
+
+FixedTemperature toFixedTemperature(const float temperature)
+{
+	const float scaled = temperature * fixed_temperature_one;
+	return saturate16(scaled < INT16_MIN ? INT16_MIN : (scaled > INT16_MAX ? INT16_MAX : lroundf(scaled)));
+}
+
+void toFixedTemperatures(const float * temperatures, FixedTemperature * output, const size_t count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		output[i] = toFixedTemperature(temperatures[i]);
+	}
+}
+
+static FixedResamplePlan::Tap quantizeTap(const ResamplePlan::Tap & tap, const int tap_count, const int weight_bits)
+{
+	FixedResamplePlan::Tap fixed = {};
+	int32_t sum = 0;
+	int largest = 0;
+	for (int k = 0; k < tap_count; ++k) {
+		fixed.index[k] = static_cast<uint16_t>(tap.index[k]);
+		fixed.weight[k] = saturate16(static_cast<int32_t>(lroundf(tap.weight[k] * (1 << weight_bits))));
+		sum += fixed.weight[k];
+		if (std::abs(tap.weight[k]) > std::abs(tap.weight[largest])) {
+			largest = k;
+		}
+	}
+	// rounding must not change the gain, give the difference to the
+	// largest weight
+	fixed.weight[largest] = saturate16(fixed.weight[largest] + (1 << weight_bits) - sum);
+	return fixed;
+}
+
+FixedResamplePlan::FixedResamplePlan(const ResamplePlan & plan) : source(plan.Source()), scaled_width(plan.ScaledWidth()),
+	scaled_height(plan.ScaledHeight()), tap_count(plan.TapCount()), weight_bits(15), columns(scaled_width), rows(scaled_height)
+{
+	// renormalized edge taps of kernels which drop taps outside the image
+	// can reach 1 and more, those plans use Q2.14
+	for (int i = 0; i < scaled_width + scaled_height; ++i) {
+		const ResamplePlan::Tap & tap = i < scaled_width ? plan.ColumnTap(i) : plan.RowTap(i - scaled_width);
+		for (int k = 0; k < tap_count; ++k) {
+			if (std::abs(tap.weight[k]) >= 0.999f) {
+				weight_bits = 14;
+			}
+		}
+	}
+
+	for (int i = 0; i < scaled_width; ++i) {
+		columns[i] = quantizeTap(plan.ColumnTap(i), tap_count, weight_bits);
+	}
+	for (int i = 0; i < scaled_height; ++i) {
+		rows[i] = quantizeTap(plan.RowTap(i), tap_count, weight_bits);
+	}
+}
+
+void FixedResamplePlan::Apply(const FixedTemperature * input, FixedTemperature * output, std::vector<FixedTemperature> & scratch) const
+{
+	switch (tap_count) {
+	case 1: ApplyPasses<1>(input, output, scratch); break;
+	case 2: ApplyPasses<2>(input, output, scratch); break;
+	case 4: ApplyPasses<4>(input, output, scratch); break;
+	default: ApplyPasses<taps>(input, output, scratch); break;
+	}
+}
+
+void FixedResamplePlan::Apply(const FixedTemperature * input, FixedTemperature * output) const
+{
+	std::vector<FixedTemperature> scratch;
+	Apply(input, output, scratch);
+}
+
+template<int Taps>
+void FixedResamplePlan::ApplyPasses(const FixedTemperature * input, FixedTemperature * output, std::vector<FixedTemperature> & scratch) const
+{
+	const int32_t rounding = 1 << (weight_bits - 1);
+	const int width = scaled_width;
+
+	// horizontal pass, a gather per output column
+	scratch.resize(static_cast<size_t>(source.height) * width);
+	int16_t * const h = scratch.data();
+	for (int source_row = 0; source_row < source.height; ++source_row) {
+		const int16_t * in = input + source_row * source.width;
+		int16_t * out = h + source_row * width;
+		for (int col = 0; col < width; ++col) {
+			const Tap & t = columns[col];
+			int32_t accumulator = rounding;
+			for (int k = 0; k < Taps; ++k) {
+				accumulator += in[t.index[k]] * t.weight[k];
+			}
+			out[col] = saturate16(accumulator >> weight_bits);
+		}
+	}
+
+	// vertical pass, the same weight for a whole row of h
+	for (int row = 0; row < scaled_height; ++row) {
+		const Tap & t = rows[row];
+		int16_t * out = output + row * width;
+		int col = 0;
+#if defined(FIXEDPOINT_SSE2)
+		const __m128i shift = _mm_cvtsi32_si128(weight_bits);
+		// taps in pairs: interleaving two rows of h lets pmaddwd do two
+		// multiply-adds per 32 bit lane
+		for (; col + 8 <= width; col += 8) {
+			__m128i low = _mm_set1_epi32(rounding);
+			__m128i high = low;
+			for (int k = 0; k < Taps; k += 2) {
+				const int16_t * a = h + t.index[k] * width + col;
+				const int16_t * b = h + t.index[k + 1 < Taps ? k + 1 : k] * width + col;
+				const int16_t wb = k + 1 < Taps ? t.weight[k + 1] : 0;
+				const __m128i weights = _mm_set1_epi32((static_cast<uint16_t>(wb) << 16) | static_cast<uint16_t>(t.weight[k]));
+				const __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a));
+				const __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b));
+				low = _mm_add_epi32(low, _mm_madd_epi16(_mm_unpacklo_epi16(va, vb), weights));
+				high = _mm_add_epi32(high, _mm_madd_epi16(_mm_unpackhi_epi16(va, vb), weights));
+			}
+			low = _mm_sra_epi32(low, shift);
+			high = _mm_sra_epi32(high, shift);
+			_mm_storeu_si128(reinterpret_cast<__m128i *>(out + col), _mm_packs_epi32(low, high));
+		}
+#elif defined(FIXEDPOINT_NEON)
+		const int32x4_t shift = vdupq_n_s32(-weight_bits); // rounding right shift
+		for (; col + 8 <= width; col += 8) {
+			int32x4_t low = vdupq_n_s32(0);
+			int32x4_t high = vdupq_n_s32(0);
+			for (int k = 0; k < Taps; ++k) {
+				const int16x8_t v = vld1q_s16(h + t.index[k] * width + col);
+				low = vmlal_n_s16(low, vget_low_s16(v), t.weight[k]);
+				high = vmlal_n_s16(high, vget_high_s16(v), t.weight[k]);
+			}
+			vst1q_s16(out + col, vcombine_s16(vqmovn_s32(vrshlq_s32(low, shift)), vqmovn_s32(vrshlq_s32(high, shift))));
+		}
+#endif
+		for (; col < width; ++col) {
+			int32_t accumulator = rounding;
+			for (int k = 0; k < Taps; ++k) {
+				accumulator += h[t.index[k] * width + col] * t.weight[k];
+			}
+			out[col] = saturate16(accumulator >> weight_bits);
+		}
+	}
+}
+
+std::shared_ptr<const FixedResamplePlan> getFixedResamplePlan(const SensorGeometry & source, const int scaled_width, const int scaled_height,
+	const ResampleKernel kernel)
+{
+	static std::mutex lock;
+	static std::map<std::tuple<SensorGeometry, int, int, ResampleKernel>, std::shared_ptr<const FixedResamplePlan>> plans;
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto & plan = plans[std::make_tuple(source, scaled_width, scaled_height, kernel)];
+	if (!plan) {
+		plan = std::make_shared<const FixedResamplePlan>(*getResamplePlan(source, scaled_width, scaled_height, kernel));
+	}
+	return plan;
+}
+
+void colorizeFixed(const FixedTemperature * field, const size_t count, const FixedTemperature min, const FixedTemperature max,
+	const uint32_t * palette, uint32_t * pixels)
+{
+	// 255 / (max - min) in Q16, range * scale stays below 2^24
+	const int32_t range = std::max(1, max - min);
+	const int32_t scale = (255 << 16) / range;
+	for (size_t i = 0; i < count; ++i) {
+		const int32_t offset = std::min(range, std::max(0, field[i] - min));
+		pixels[i] = palette[(offset * scale) >> 16];
+	}
+}
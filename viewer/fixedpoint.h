@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "geometry.h"
+#include "resample.h"
+
+// Integer version of the resample and colorize path, for gateways and
+// microcontrollers without fast floating point.
+//
+// Temperatures are Q8.8 (1/256 degC steps, -128 to +127.99 degC) and the
+// weights Q1.15, or Q2.14 for plans with weights of 1 or more (Lanczos-3
+// renormalized at the edges). Both passes multiply 16 bit values into 32 bit
+// accumulators and round back to Q8.8, which maps to 16 bit SIMD
+// multiply-adds (pmaddwd, vmlal.s16). Weights come from the float plan, so
+// the kernels and their edge handling are the same, and nothing but the
+// plan construction touches floating point; on a microcontroller the tap
+// tables can be generated offline.
+//
+// Against the float plan the error stays below 0.02 degC for temperatures
+// in range (see runResampleHarness). Values beyond the Q8.8 range
+// saturate.
+
+// Q8.8
+typedef int16_t FixedTemperature;
+static const int fixed_temperature_one = 256;
+
+FixedTemperature toFixedTemperature(float temperature);
+inline float fromFixedTemperature(const FixedTemperature t) { return t / static_cast<float>(fixed_temperature_one); }
+void toFixedTemperatures(const float * temperatures, FixedTemperature * output, size_t count);
+
+class FixedResamplePlan
+{
+public:
+	static const int taps = ResamplePlan::taps;
+
+	struct Tap
+	{
+		uint16_t index[taps];
+		int16_t weight[taps]; // Q1.15 or Q2.14, sums to 1
+	};
+
+	explicit FixedResamplePlan(const ResamplePlan & plan);
+
+	const SensorGeometry & Source() const { return source; }
+	int ScaledWidth() const { return scaled_width; }
+	int ScaledHeight() const { return scaled_height; }
+
+	// input: source width * height samples,
+	// output: scaled_width * scaled_height samples.
+	// scratch holds the horizontal pass, as with ResamplePlan::Apply.
+	void Apply(const FixedTemperature * input, FixedTemperature * output, std::vector<FixedTemperature> & scratch) const;
+	void Apply(const FixedTemperature * input, FixedTemperature * output) const;
+
+private:
+	template<int Taps>
+	void ApplyPasses(const FixedTemperature * input, FixedTemperature * output, std::vector<FixedTemperature> & scratch) const;
+
+	SensorGeometry source;
+	int scaled_width;
+	int scaled_height;
+	int tap_count;
+	int weight_bits; // fraction bits of the weights
+	std::vector<Tap> columns;
+	std::vector<Tap> rows;
+};
+
+std::shared_ptr<const FixedResamplePlan> getFixedResamplePlan(const SensorGeometry & source, int scaled_width, int scaled_height,
+	ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+
+// Palette index of each temperature, mapping [min, max] linearly to
+// [0, 255] with one multiply and shift per pixel. palette: 256 colors.
+void colorizeFixed(const FixedTemperature * field, size_t count, FixedTemperature min, FixedTemperature max,
+	const uint32_t * palette, uint32_t * pixels);
@@ -0,0 +1,240 @@
+#include "pch.h"
+#include "framering.h"
+
+static const uint32_t ring_magic = 0x474e5254; // "TRNG"
+static const uint32_t ring_version = 1;
+static const size_t header_size = 64;
+static const size_t slot_alignment = 64;
+
+static_assert(sizeof(FrameRingHeader) <= header_size, "header does not fit");
+
+FrameRingWriter::FrameRingWriter() : mapping(nullptr), header(nullptr), slots(nullptr)
+{
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+	Close();
+}
+
+bool FrameRingWriter::Create(const std::wstring & name, const uint32_t slotCount, const uint32_t slotSize)
+{
+	Close();
+
+	const uint32_t stride = static_cast<uint32_t>((sizeof(FrameRingSlot) + slotSize + slot_alignment - 1) / slot_alignment * slot_alignment);
+	const uint64_t size = header_size + static_cast<uint64_t>(slotCount) * stride;
+
+	mapping = CreateFileMappingFromApp(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, size, name.c_str());
+	if (!mapping) {
+		return false;
+	}
+	const bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+	void * view = MapViewOfFileFromApp(mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, size);
+	if (!view) {
+		Close();
+		return false;
+	}
+	header = static_cast<FrameRingHeader *>(view);
+	slots = static_cast<uint8_t *>(view) + header_size;
+
+	// a ring left over by an earlier run is continued, so its readers keep
+	// their positions
+	if (existed && header->magic == ring_magic && header->version == ring_version &&
+		header->slotCount == slotCount && header->slotSize == slotSize && header->slotStride == stride) {
+		return true;
+	}
+
+	memset(view, 0, static_cast<size_t>(size));
+	header->version = ring_version;
+	header->slotCount = slotCount;
+	header->slotSize = slotSize;
+	header->slotStride = stride;
+	header->written.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = ring_magic;
+	return true;
+}
+
+void FrameRingWriter::Close()
+{
+	if (header) {
+		UnmapViewOfFile(header);
+		header = nullptr;
+		slots = nullptr;
+	}
+	if (mapping) {
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+}
+
+FrameRingSlot * FrameRingWriter::Begin(uint8_t ** payload)
+{
+	if (!header) {
+		return nullptr;
+	}
+	const uint64_t index = header->written.load(std::memory_order_relaxed);
+	auto * slot = reinterpret_cast<FrameRingSlot *>(slots + (index % header->slotCount) * header->slotStride);
+
+	// odd: readers discard the slot until Commit
+	slot->sequence.store(2 * index + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	*payload = reinterpret_cast<uint8_t *>(slot + 1);
+	return slot;
+}
+
+void FrameRingWriter::Commit(FrameRingSlot * slot)
+{
+	const uint64_t sequence = slot->sequence.load(std::memory_order_relaxed) + 1;
+	slot->sequence.store(sequence, std::memory_order_release);
+	header->written.store(sequence / 2, std::memory_order_release);
+}
+
+bool FrameRingWriter::Publish(const FrameRingSlot & info, const void * payload)
+{
+	if (!header || info.length > header->slotSize) {
+		return false;
+	}
+	uint8_t * data;
+	FrameRingSlot * slot = Begin(&data);
+	slot->sequenceNumber = info.sequenceNumber;
+	slot->length = info.length;
+	slot->format = info.format;
+	slot->width = info.width;
+	slot->height = info.height;
+	slot->reserved = 0;
+	slot->timestampUs = info.timestampUs;
+	memcpy(data, payload, info.length);
+	Commit(slot);
+	return true;
+}
+
+#if WINAPI_FAMILY_PARTITION(WINAPI_PARTITION_DESKTOP)
+FrameRingReader::FrameRingReader() : mapping(nullptr), header(nullptr), slots(nullptr), position(0), expected(0), overruns(0)
+{
+}
+
+FrameRingReader::~FrameRingReader()
+{
+	Close();
+}
+
+bool FrameRingReader::Open(const std::wstring & name)
+{
+	Close();
+
+	mapping = OpenFileMappingW(FILE_MAP_READ, FALSE, name.c_str());
+	if (!mapping) {
+		return false;
+	}
+	const void * view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!view) {
+		Close();
+		return false;
+	}
+	header = static_cast<const FrameRingHeader *>(view);
+	slots = static_cast<const uint8_t *>(view) + header_size;
+
+	MEMORY_BASIC_INFORMATION region;
+	const bool valid = header->magic == ring_magic && header->version == ring_version && header->slotCount > 0 &&
+		VirtualQuery(view, &region, sizeof region) != 0 &&
+		region.RegionSize >= header_size + static_cast<uint64_t>(header->slotCount) * header->slotStride;
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (!valid) {
+		Close();
+		return false;
+	}
+
+	const uint64_t written = header->written.load(std::memory_order_acquire);
+	position = written > 0 ? written - 1 : 0;
+	overruns = 0;
+	return true;
+}
+
+void FrameRingReader::Close()
+{
+	if (header) {
+		UnmapViewOfFile(header);
+		header = nullptr;
+		slots = nullptr;
+	}
+	if (mapping) {
+		CloseHandle(mapping);
+		mapping = nullptr;
+	}
+}
+
+const FrameRingSlot * FrameRingReader::Slot(const uint64_t index) const
+{
+	return reinterpret_cast<const FrameRingSlot *>(slots + (index % header->slotCount) * header->slotStride);
+}
+
+const FrameRingSlot * FrameRingReader::Peek(const uint8_t ** payload)
+{
+	if (!header) {
+		return nullptr;
+	}
+
+	for (;;) {
+		const uint64_t written = header->written.load(std::memory_order_acquire);
+		if (position >= written) {
+			return nullptr;
+		}
+
+		// the slot of the oldest frame is the next one to be overwritten,
+		// skip it too when catching up
+		if (written - position >= header->slotCount) {
+			const uint64_t oldest = written - header->slotCount + 1;
+			overruns += oldest - position;
+			position = oldest;
+		}
+
+		const FrameRingSlot * slot = Slot(position);
+		const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+		if (sequence == 2 * position + 2) {
+			expected = sequence;
+			*payload = reinterpret_cast<const uint8_t *>(slot + 1);
+			return slot;
+		}
+
+		// overwritten since written was read
+		++overruns;
+		++position;
+	}
+}
+
+bool FrameRingReader::Validate(const FrameRingSlot * slot) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return slot->sequence.load(std::memory_order_relaxed) == expected;
+}
+
+void FrameRingReader::Advance()
+{
+	++position;
+}
+
+bool FrameRingReader::Read(FrameRingSlot & info, uint8_t * buffer)
+{
+	const uint8_t * payload;
+	while (const FrameRingSlot * slot = Peek(&payload)) {
+		info.sequenceNumber = slot->sequenceNumber;
+		info.length = std::min(slot->length, header->slotSize);
+		info.format = slot->format;
+		info.width = slot->width;
+		info.height = slot->height;
+		info.timestampUs = slot->timestampUs;
+		memcpy(buffer, payload, info.length);
+
+		const bool valid = Validate(slot);
+		Advance();
+		if (valid) {
+			return true;
+		}
+		++overruns;
+	}
+	return false;
+}
+#endif
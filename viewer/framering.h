@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <winapifamily.h>
+
+// Ring of fixed size frame slots in shared memory, for passing frames to
+// co-located processes (recorder, analytics) without sockets or copies on
+// the reader side.
+//
+// There is one writer and any number of readers, none of which take locks.
+// Every slot carries a sequence number, odd while the writer is filling
+// the slot and 2 * (frame index + 1) once complete. Readers check it before
+// and after looking at a slot, and discard what they read if the slot was
+// overwritten meanwhile. Each reader keeps its own position, and counts the
+// frames it lost by falling more than a ring behind.
+//
+// The ring is a named file mapping, header first, then the slots:
+//
+//   FrameRingHeader
+//   slotCount * (FrameRingSlot + slotSize payload bytes, rounded up to 64)
+//
+// The viewer only writes. Its mapping is created inside its AppContainer,
+// so the name readers open is qualified by the package SID:
+//
+//   AppContainerNamedObjects\<package SID>\thermocam-frames
+//
+// The SID string comes from DeriveAppContainerSidFromAppContainerName with
+// the package family name, then ConvertSidToStringSid. Opening a mapping
+// of another package from an app needs OpenFileMappingFromApp (SDK 18362),
+// the viewer targets older systems, so the reader is built for desktop
+// processes only.
+
+struct FrameRingHeader
+{
+	uint32_t magic;    // "TRNG"
+	uint32_t version;
+	uint32_t slotCount;
+	uint32_t slotSize; // payload bytes per slot
+	uint32_t slotStride;
+	uint32_t reserved;
+	std::atomic<uint64_t> written; // frames published so far
+};
+
+struct FrameRingSlot
+{
+	std::atomic<uint64_t> sequence;
+	uint32_t sequenceNumber; // of the sensor, or of the viewer if the sensor has none
+	uint32_t length;         // payload bytes
+	uint16_t format;         // FrameFormat
+	uint16_t width;
+	uint16_t height;
+	uint16_t reserved;
+	uint64_t timestampUs;
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the ring relies on lock free 64 bit atomics");
+
+class FrameRingWriter
+{
+public:
+	FrameRingWriter();
+	~FrameRingWriter();
+	FrameRingWriter(const FrameRingWriter &) = delete;
+	FrameRingWriter & operator=(const FrameRingWriter &) = delete;
+
+	bool Create(const std::wstring & name, uint32_t slotCount, uint32_t slotSize);
+	void Close();
+	bool IsOpen() const { return header != nullptr; }
+	uint32_t SlotSize() const { return header ? header->slotSize : 0; }
+
+	// Fills the next slot in place: Begin returns its payload, Commit
+	// publishes it. Payload fields of the returned slot can be set between
+	// the two calls.
+	FrameRingSlot * Begin(uint8_t ** payload);
+	void Commit(FrameRingSlot * slot);
+
+	// Begin, copy, Commit. False if the ring is closed or length too large.
+	bool Publish(const FrameRingSlot & info, const void * payload);
+
+private:
+	void * mapping;
+	FrameRingHeader * header;
+	uint8_t * slots;
+};
+
+#if WINAPI_FAMILY_PARTITION(WINAPI_PARTITION_DESKTOP)
+class FrameRingReader
+{
+public:
+	FrameRingReader();
+	~FrameRingReader();
+	FrameRingReader(const FrameRingReader &) = delete;
+	FrameRingReader & operator=(const FrameRingReader &) = delete;
+
+	// Starts reading at the newest frame.
+	bool Open(const std::wstring & name);
+	void Close();
+	bool IsOpen() const { return header != nullptr; }
+
+	// Looks at the next unread frame in place. The payload may be
+	// overwritten while it is being used, results derived from it are only
+	// valid if Validate() returns true afterwards. Returns nullptr if there
+	// is no new frame.
+	const FrameRingSlot * Peek(const uint8_t ** payload);
+	bool Validate(const FrameRingSlot * slot) const;
+	void Advance();
+
+	// Copies the next frame out, buffer must hold the ring's slot size.
+	bool Read(FrameRingSlot & info, uint8_t * buffer);
+
+	uint64_t Position() const { return position; }
+	uint64_t Overruns() const { return overruns; }
+
+private:
+	const FrameRingSlot * Slot(uint64_t index) const;
+
+	void * mapping;
+	const FrameRingHeader * header;
+	const uint8_t * slots;
+	uint64_t position;      // index of the next frame to read
+	uint64_t expected;      // sequence of the peeked slot
+	uint64_t overruns;
+};
+#endif
@@ -0,0 +1,441 @@
+#include "pch.h"
+#include "frameserver.h"
+
+using namespace winrt;
+using namespace Windows::Foundation;
+using namespace Windows::Networking::Sockets;
+using namespace Windows::Security::Cryptography;
+using namespace Windows::Security::Cryptography::Core;
+using namespace Windows::Storage::Streams;
+using namespace Windows::System::Threading;
+
+static const uint32_t max_request_size = 4096;
+static const std::chrono::seconds request_timeout{ 5 };
+
+static const wchar_t * const format_names[] = { L"raw", L"decoded", L"rendered" };
+
+static bool parseFormat(const std::wstring & name, FrameFormat & format)
+{
+	for (size_t i = 0; i < static_cast<size_t>(FrameFormat::Count); ++i) {
+		if (name == format_names[i]) {
+			format = static_cast<FrameFormat>(i);
+			return true;
+		}
+	}
+	return false;
+}
+
+static std::wstring lowercase(std::wstring s)
+{
+	std::transform(s.begin(), s.end(), s.begin(), ::towlower);
+	return s;
+}
+
+static std::wstring trim(const std::wstring & s)
+{
+	const auto begin = s.find_first_not_of(L" \t\r\n");
+	if (begin == std::wstring::npos) {
+		return std::wstring();
+	}
+	return s.substr(begin, s.find_last_not_of(L" \t\r\n") - begin + 1);
+}
+
+// Sec-WebSocket-Accept value for the client's key, RFC 6455 4.2.2
+static std::wstring webSocketAccept(const std::wstring & key)
+{
+	const IBuffer input = CryptographicBuffer::ConvertStringToBinary(key + L"258EAFA5-E914-47DA-95CA-C5AB0DC85B11", BinaryStringEncoding::Utf8);
+	const IBuffer hash = HashAlgorithmProvider::OpenAlgorithm(HashAlgorithmNames::Sha1()).HashData(input);
+	return std::wstring(CryptographicBuffer::EncodeToBase64String(hash));
+}
+
+// final, unmasked control frame, RFC 6455 5.5
+static IBuffer webSocketControlFrame(const uint8_t opcode, const std::vector<uint8_t> & payload)
+{
+	DataWriter writer;
+	writer.WriteByte(0x80 | opcode);
+	writer.WriteByte(static_cast<uint8_t>(payload.size()));
+	writer.WriteBytes(payload);
+	return writer.DetachBuffer();
+}
+
+FrameServer::FrameServer()
+{
+}
+
+FrameServer::~FrameServer()
+{
+	Stop();
+}
+
+IAsyncAction FrameServer::StartAsync(const uint16_t port)
+{
+	listener = StreamSocketListener();
+	listener.Control().NoDelay(true);
+	tokenForConnectionReceived = listener.ConnectionReceived({ this, &FrameServer::OnConnectionReceived });
+	co_await listener.BindServiceNameAsync(std::to_wstring(port));
+}
+
+void FrameServer::Stop()
+{
+	if (listener) {
+		listener.ConnectionReceived(tokenForConnectionReceived);
+		listener.Close();
+		listener = nullptr;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+	for (const auto & subscriber : subscribers) {
+		subscriber->socket.Close();
+	}
+	subscribers.clear();
+}
+
+bool FrameServer::HasSubscribers(const FrameFormat format) const
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return std::any_of(subscribers.begin(), subscribers.end(), [format](const std::shared_ptr<Subscriber> & s) { return s->format == format; });
+}
+
+void FrameServer::OnConnectionReceived(StreamSocketListener, StreamSocketListenerConnectionReceivedEventArgs args)
+{
+	Accept(args.Socket());
+}
+
+fire_and_forget FrameServer::Accept(StreamSocket socket)
+{
+	// read the request, either a single line or a http header. The deadline
+	// cancels the pending load from a timer, a client that connects and
+	// stays silent doesn't hold the socket.
+	std::string request;
+	const auto deadline = std::chrono::steady_clock::now() + request_timeout;
+	try {
+		DataReader reader(socket.InputStream());
+		reader.InputStreamOptions(InputStreamOptions::Partial);
+		while (request.size() < max_request_size) {
+			const auto remaining = deadline - std::chrono::steady_clock::now();
+			if (remaining <= std::chrono::steady_clock::duration::zero()) {
+				throw hresult_error(HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+			}
+			auto load = reader.LoadAsync(max_request_size - static_cast<uint32_t>(request.size()));
+			ThreadPoolTimer timer = ThreadPoolTimer::CreateTimer([load](ThreadPoolTimer) {
+				load.Cancel();
+			}, std::chrono::duration_cast<TimeSpan>(remaining));
+			const uint32_t loaded = co_await load;
+			timer.Cancel();
+			if (loaded == 0) {
+				break; // closed before completing the request
+			}
+			std::vector<uint8_t> bytes(loaded);
+			reader.ReadBytes(bytes);
+			request.append(bytes.begin(), bytes.end());
+
+			const bool http = request.compare(0, 4, "GET ") == 0;
+			if ((http && request.find("\r\n\r\n") != std::string::npos) || (!http && request.find('\n') != std::string::npos)) {
+				break;
+			}
+		}
+		reader.DetachStream();
+	}
+	catch (hresult_error const &) {
+		socket.Close();
+		co_return;
+	}
+
+	auto subscriber = std::make_shared<Subscriber>();
+	subscriber->socket = socket;
+	subscriber->webSocket = false;
+	subscriber->minInterval = std::chrono::steady_clock::duration::zero();
+	subscriber->sending = false;
+	subscriber->dropped = 0;
+	subscriber->closing = false;
+
+	std::wstringstream lines(std::wstring(request.begin(), request.end()));
+	std::wstring line;
+	std::getline(lines, line);
+	std::wstringstream words(trim(line));
+	std::wstring command, target;
+	words >> command >> target;
+
+	bool valid = false;
+	double fps = 0;
+	std::wstring response;
+	if (command == L"SUBSCRIBE") {
+		valid = parseFormat(target, subscriber->format);
+		words >> fps;
+		response = valid ? L"OK\n" : L"ERROR unknown format\n";
+	}
+	else if (command == L"GET") {
+		// /<format>[?fps=<n>]
+		const auto query = target.find(L'?');
+		valid = target.size() > 1 && parseFormat(target.substr(1, query - 1), subscriber->format);
+		if (query != std::wstring::npos && target.compare(query + 1, 4, L"fps=") == 0) {
+			fps = _wtof(target.c_str() + query + 5);
+		}
+
+		std::wstring key;
+		while (std::getline(lines, line)) {
+			const auto colon = line.find(L':');
+			if (colon != std::wstring::npos && lowercase(trim(line.substr(0, colon))) == L"sec-websocket-key") {
+				key = trim(line.substr(colon + 1));
+			}
+		}
+		valid = valid && !key.empty();
+		subscriber->webSocket = valid;
+		response = valid ?
+			L"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: " + webSocketAccept(key) + L"\r\n\r\n" :
+			L"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+	}
+
+	try {
+		DataWriter writer(socket.OutputStream());
+		writer.UnicodeEncoding(UnicodeEncoding::Utf8);
+		writer.WriteString(response.empty() ? L"ERROR unknown command\n" : response);
+		co_await writer.StoreAsync();
+		writer.DetachStream();
+	}
+	catch (hresult_error const &) {
+		valid = false;
+	}
+	if (!valid) {
+		socket.Close();
+		co_return;
+	}
+
+	if (fps > 0) {
+		subscriber->minInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1 / fps));
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		subscribers.push_back(subscriber);
+	}
+	if (subscriber->webSocket) {
+		Receive(subscriber);
+	}
+}
+
+fire_and_forget FrameServer::Receive(std::shared_ptr<Subscriber> subscriber)
+{
+	// client frames, RFC 6455 5.2: always masked, control frames of at most
+	// 125 bytes. A protocol error or a message larger than a request closes
+	// the connection.
+	try {
+		DataReader reader(subscriber->socket.InputStream());
+		for (;;) {
+			if (co_await reader.LoadAsync(2) < 2) {
+				break;
+			}
+			const uint8_t opcode = reader.ReadByte() & 0x0f;
+			const uint8_t second = reader.ReadByte();
+			uint64_t length = second & 0x7f;
+			if (length == 126) {
+				if (co_await reader.LoadAsync(2) < 2) {
+					break;
+				}
+				length = reader.ReadUInt16(); // DataReader defaults to big endian
+			}
+			else if (length == 127) {
+				if (co_await reader.LoadAsync(8) < 8) {
+					break;
+				}
+				length = reader.ReadUInt64();
+			}
+			if (!(second & 0x80) || length > max_request_size || ((opcode & 0x08) && length > 125)) {
+				break;
+			}
+
+			const uint32_t size = 4 + static_cast<uint32_t>(length);
+			if (co_await reader.LoadAsync(size) < size) {
+				break;
+			}
+			uint8_t mask[4];
+			reader.ReadBytes(mask);
+			std::vector<uint8_t> payload(static_cast<size_t>(length));
+			reader.ReadBytes(payload);
+			for (size_t i = 0; i < payload.size(); ++i) {
+				payload[i] ^= mask[i % 4];
+			}
+
+			if (opcode == 0x08) {
+				// echo the status code, the socket is closed once it is sent
+				payload.resize(std::min<size_t>(payload.size(), 2));
+				SendControl(subscriber, webSocketControlFrame(0x08, payload), true);
+				co_return;
+			}
+			if (opcode == 0x09) {
+				SendControl(subscriber, webSocketControlFrame(0x0a, payload), false);
+			}
+		}
+	}
+	catch (hresult_error const &) {
+	}
+	Remove(subscriber);
+}
+
+void FrameServer::SendControl(const std::shared_ptr<Subscriber> & subscriber, IBuffer frame, const bool close)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		if (subscriber->closing) {
+			return;
+		}
+		// an unanswered ping is superseded by the next one, RFC 6455 5.5.3
+		subscriber->control = frame;
+		subscriber->closing = close;
+		if (subscriber->sending) {
+			return;
+		}
+		subscriber->sending = true;
+	}
+	Send(subscriber);
+}
+
+std::shared_ptr<const FrameServer::EncodedFrame> FrameServer::Encode(const PublishedFrame & frame, const FrameFormat format)
+{
+	FrameMessageHeader header = {};
+	header.sequence = frame.sequence;
+	header.format = static_cast<uint16_t>(format);
+
+	const uint8_t * payload = nullptr;
+	size_t size = 0;
+	switch (format) {
+	case FrameFormat::Raw:
+		header.width = static_cast<uint16_t>(frame.width);
+		header.height = static_cast<uint16_t>(frame.height);
+		payload = frame.raw;
+		size = frame.rawLength;
+		break;
+	case FrameFormat::Decoded:
+		header.width = static_cast<uint16_t>(frame.width);
+		header.height = static_cast<uint16_t>(frame.height);
+		payload = reinterpret_cast<const uint8_t *>(frame.temperatures);
+		size = static_cast<size_t>(frame.width) * frame.height * sizeof(float);
+		break;
+	case FrameFormat::Rendered:
+		if (!frame.image) {
+			return nullptr;
+		}
+		header.width = static_cast<uint16_t>(frame.imageWidth);
+		header.height = static_cast<uint16_t>(frame.imageHeight);
+		payload = reinterpret_cast<const uint8_t *>(frame.image);
+		size = static_cast<size_t>(frame.imageWidth) * frame.imageHeight * sizeof(uint32_t);
+		break;
+	}
+	header.length = static_cast<uint32_t>(sizeof header - sizeof header.length + size);
+
+	auto encoded = std::make_shared<EncodedFrame>();
+
+	DataWriter writer;
+	writer.WriteBytes(array_view<const uint8_t>(reinterpret_cast<const uint8_t *>(&header), sizeof header));
+	writer.WriteBytes(array_view<const uint8_t>(payload, static_cast<uint32_t>(size)));
+	encoded->message = writer.DetachBuffer();
+
+	// binary, final, unmasked frame
+	const uint64_t length = sizeof header + size;
+	writer.WriteByte(0x82);
+	if (length < 126) {
+		writer.WriteByte(static_cast<uint8_t>(length));
+	}
+	else if (length <= 0xffff) {
+		writer.WriteByte(126);
+		writer.WriteUInt16(static_cast<uint16_t>(length)); // DataWriter defaults to big endian
+	}
+	else {
+		writer.WriteByte(127);
+		writer.WriteUInt64(length);
+	}
+	encoded->webSocketHeader = writer.DetachBuffer();
+
+	return encoded;
+}
+
+void FrameServer::Publish(const PublishedFrame & frame)
+{
+	const auto now = std::chrono::steady_clock::now();
+	std::shared_ptr<const EncodedFrame> encoded[static_cast<size_t>(FrameFormat::Count)];
+	std::vector<std::shared_ptr<Subscriber>> start;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		for (const auto & subscriber : subscribers) {
+			if (subscriber->closing || now - subscriber->lastQueued < subscriber->minInterval) {
+				continue;
+			}
+
+			auto & e = encoded[static_cast<size_t>(subscriber->format)];
+			if (!e) {
+				e = Encode(frame, subscriber->format);
+				if (!e) {
+					continue;
+				}
+			}
+
+			if (subscriber->pending) {
+				++subscriber->dropped; // socket still busy, replace the queued frame
+			}
+			subscriber->pending = e;
+			subscriber->lastQueued = now;
+			if (!subscriber->sending) {
+				subscriber->sending = true;
+				start.push_back(subscriber);
+			}
+		}
+	}
+
+	for (const auto & subscriber : start) {
+		Send(subscriber);
+	}
+}
+
+fire_and_forget FrameServer::Send(std::shared_ptr<Subscriber> subscriber)
+{
+	IOutputStream stream = subscriber->socket.OutputStream();
+
+	for (;;) {
+		std::shared_ptr<const EncodedFrame> frame;
+		IBuffer control{ nullptr };
+		bool closing;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			control = subscriber->control;
+			subscriber->control = nullptr;
+			closing = subscriber->closing;
+			if (!control) {
+				frame = std::move(subscriber->pending);
+				subscriber->pending = nullptr;
+				if (!frame) {
+					subscriber->sending = false;
+					co_return;
+				}
+			}
+		}
+
+		try {
+			if (control) {
+				co_await stream.WriteAsync(control);
+				if (closing) {
+					Remove(subscriber);
+					co_return;
+				}
+				continue;
+			}
+			if (subscriber->webSocket) {
+				co_await stream.WriteAsync(frame->webSocketHeader);
+			}
+			co_await stream.WriteAsync(frame->message);
+		}
+		catch (hresult_error const &) {
+			Remove(subscriber);
+			co_return;
+		}
+	}
+}
+
+void FrameServer::Remove(const std::shared_ptr<Subscriber> & subscriber)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		subscribers.erase(std::remove(subscribers.begin(), subscribers.end(), subscriber), subscribers.end());
+	}
+	subscriber->socket.Close();
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Publishes the frames of the viewer to other local processes and machines
+// on the LAN: dashboards, alarm engines, recorders.
+//
+// Subscribers connect over TCP and either send a single request line
+//
+//   SUBSCRIBE <raw|decoded|rendered> [max fps]\n
+//
+// or a WebSocket upgrade request for the path /<format>[?fps=<max fps>].
+// Every frame is then sent as one message (one binary WebSocket message),
+// starting with a FrameMessageHeader.
+//
+// The request has to arrive within request_timeout. WebSocket subscribers
+// get pings answered and closes echoed, anything else they send is ignored.
+//
+// Each format is encoded at most once per frame, into a refcounted buffer
+// written to all subscribers of that format. A subscriber whose socket is
+// still busy only keeps the latest frame, slow consumers skip frames
+// instead of growing queues.
+
+enum class FrameFormat : uint16_t
+{
+	Raw,      // characteristic value, as received from the sensor
+	Decoded,  // width * height float temperatures in degC
+	Rendered, // width * height BGRA pixels
+	Count,
+};
+
+#pragma pack(push, 1)
+struct FrameMessageHeader
+{
+	uint32_t length;   // bytes following this field
+	uint32_t sequence;
+	uint16_t format;   // FrameFormat
+	uint16_t width;
+	uint16_t height;
+	uint16_t reserved;
+};
+#pragma pack(pop)
+
+struct PublishedFrame
+{
+	uint32_t sequence;
+	const uint8_t * raw;
+	size_t rawLength;
+	const float * temperatures; // width * height
+	int width;                  // of the sensor
+	int height;
+	const uint32_t * image;     // may be null
+	int imageWidth;
+	int imageHeight;
+};
+
+class FrameServer
+{
+public:
+	FrameServer();
+	~FrameServer();
+
+	winrt::Windows::Foundation::IAsyncAction StartAsync(uint16_t port);
+	void Stop();
+
+	bool HasSubscribers(FrameFormat format) const;
+	void Publish(const PublishedFrame & frame);
+
+private:
+	struct EncodedFrame
+	{
+		winrt::Windows::Storage::Streams::IBuffer webSocketHeader{ nullptr };
+		winrt::Windows::Storage::Streams::IBuffer message{ nullptr };
+	};
+
+	struct Subscriber
+	{
+		winrt::Windows::Networking::Sockets::StreamSocket socket{ nullptr };
+		FrameFormat format;
+		bool webSocket;
+		std::chrono::steady_clock::duration minInterval;
+		std::chrono::steady_clock::time_point lastQueued;
+		std::shared_ptr<const EncodedFrame> pending;
+		bool sending;
+		uint32_t dropped;
+		winrt::Windows::Storage::Streams::IBuffer control{ nullptr }; // WebSocket control frame, sent before the pending frame
+		bool closing; // the close frame is queued, nothing is sent after it
+	};
+
+	void OnConnectionReceived(winrt::Windows::Networking::Sockets::StreamSocketListener listener,
+		winrt::Windows::Networking::Sockets::StreamSocketListenerConnectionReceivedEventArgs args);
+	winrt::fire_and_forget Accept(winrt::Windows::Networking::Sockets::StreamSocket socket);
+	winrt::fire_and_forget Receive(std::shared_ptr<Subscriber> subscriber);
+	winrt::fire_and_forget Send(std::shared_ptr<Subscriber> subscriber);
+	void SendControl(const std::shared_ptr<Subscriber> & subscriber, winrt::Windows::Storage::Streams::IBuffer frame, bool close);
+	void Remove(const std::shared_ptr<Subscriber> & subscriber);
+
+	static std::shared_ptr<const EncodedFrame> Encode(const PublishedFrame & frame, FrameFormat format);
+
+	winrt::Windows::Networking::Sockets::StreamSocketListener listener{ nullptr };
+	winrt::event_token tokenForConnectionReceived;
+	mutable std::mutex lock; // guards subscribers and their send state
+	std::vector<std::shared_ptr<Subscriber>> subscribers;
+};
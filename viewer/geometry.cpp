@@ -0,0 +1,45 @@
+#include "pch.h"
+#include "geometry.h"
+
+static const SensorType sensors[] = {
+	{ "AMG88xx", amg88xx_geometry, PixelFormat::Amg88xx },
+	{ "HTPA16x16", { 16, 16 }, PixelFormat::Centidegree16 },
+	{ "MLX90640", { 32, 24 }, PixelFormat::Centidegree16 },
+	{ "HTPA80x62", { 80, 62 }, PixelFormat::Centidegree16 },
+};
+
+int SensorGeometry::ScaledHeight(const int scaled_width) const
+{
+	return std::max(1, (scaled_width * height + width / 2) / width);
+}
+
+const SensorType * knownSensors(size_t * count)
+{
+	*count = sizeof sensors / sizeof sensors[0];
+	return sensors;
+}
+
+size_t payloadSize(const SensorType & sensor, const bool packed)
+{
+	const size_t pixels = sensor.geometry.PixelCount();
+	if (sensor.format == PixelFormat::Amg88xx && packed) {
+		return (pixels + 1) / 2 * 3;
+	}
+	return pixels * 2;
+}
+
+const SensorType * sensorForPayload(const size_t length)
+{
+	for (const SensorType & sensor : sensors) {
+		for (const bool packed : { false, true }) {
+			if (packed && sensor.format != PixelFormat::Amg88xx) {
+				continue;
+			}
+			const size_t size = payloadSize(sensor, packed);
+			if (length == size || length == size + trailer_size) {
+				return &sensor;
+			}
+		}
+	}
+	return nullptr;
+}
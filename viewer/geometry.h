@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+
+// Pixel grid of a thermal sensor. Frames are stored row by row, top row
+// first.
+struct SensorGeometry
+{
+	int width;
+	int height;
+
+	int PixelCount() const { return width * height; }
+
+	// Height of an image scaled_width pixels wide, keeping the aspect ratio
+	// of the sensor (with square pixels).
+	int ScaledHeight(int scaled_width) const;
+
+	bool operator==(const SensorGeometry & other) const { return width == other.width && height == other.height; }
+	bool operator!=(const SensorGeometry & other) const { return !(*this == other); }
+	bool operator<(const SensorGeometry & other) const { return width != other.width ? width < other.width : height < other.height; }
+};
+
+// Panasonic Grid-EYE, what the thermocam firmware sends
+static const SensorGeometry amg88xx_geometry = { 8, 8 };
+
+// How pixels are encoded in the characteristic value.
+enum class PixelFormat
+{
+	Amg88xx,       // 12 bit two's complement in 0.25 degC, 16 bit little endian or packed 3 bytes per 2 pixels
+	Centidegree16, // 16 bit two's complement little endian, in 0.01 degC
+};
+
+struct SensorType
+{
+	const char * name;
+	SensorGeometry geometry;
+	PixelFormat format;
+};
+
+// Sensors the viewer knows. Payload sizes are unique among them, so the
+// type of a frame is recognized from its length.
+const SensorType * knownSensors(size_t * count);
+const SensorType * sensorForPayload(size_t length);
+
+// Sequence number and capture time the firmware may append to the pixels,
+// 32 bit little endian each.
+static const size_t trailer_size = 8;
+
+// Bytes of the pixels of a frame, without the optional trailer.
+size_t payloadSize(const SensorType & sensor, bool packed);
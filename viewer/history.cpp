@@ -0,0 +1,292 @@
+#include "pch.h"
+#include "history.h"
+
+namespace
+{
+	// Appends values of a fixed bit width to a byte vector, least significant
+	// bits first.
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<uint8_t> & output) : output(output), accumulator(0), bits(0) {}
+
+		void Write(const uint32_t value, const int width)
+		{
+			accumulator |= static_cast<uint64_t>(value) << bits;
+			bits += width;
+			while (bits >= 8) {
+				output.push_back(static_cast<uint8_t>(accumulator));
+				accumulator >>= 8;
+				bits -= 8;
+			}
+		}
+
+		void Flush()
+		{
+			if (bits > 0) {
+				output.push_back(static_cast<uint8_t>(accumulator));
+			}
+			accumulator = 0;
+			bits = 0;
+		}
+
+	private:
+		std::vector<uint8_t> & output;
+		uint64_t accumulator;
+		int bits;
+	};
+
+	class BitReader
+	{
+	public:
+		explicit BitReader(const uint8_t * input) : input(input), accumulator(0), bits(0) {}
+
+		uint32_t Read(const int width)
+		{
+			while (bits < width) {
+				accumulator |= static_cast<uint64_t>(*input++) << bits;
+				bits += 8;
+			}
+			const uint32_t value = static_cast<uint32_t>(accumulator & ((uint64_t(1) << width) - 1));
+			accumulator >>= width;
+			bits -= width;
+			return value;
+		}
+
+	private:
+		const uint8_t * input;
+		uint64_t accumulator;
+		int bits;
+	};
+
+	uint32_t zigzag(const int32_t v) { return (static_cast<uint32_t>(v) << 1) ^ static_cast<uint32_t>(v >> 31); }
+	int32_t unzigzag(const uint32_t v) { return static_cast<int32_t>(v >> 1) ^ -static_cast<int32_t>(v & 1); }
+
+	uint16_t toHalf(const float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof bits);
+		const uint32_t sign = (bits >> 16) & 0x8000;
+		const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+		const uint32_t mantissa = bits & 0x7fffff;
+		if (exponent <= 0) {
+			return static_cast<uint16_t>(sign); // no subnormals, nothing that small is a temperature
+		}
+		if (exponent >= 31) {
+			return static_cast<uint16_t>(sign | 0x7c00);
+		}
+		// round to nearest, a carry into the exponent is still correct
+		return static_cast<uint16_t>((sign | (exponent << 10) | (mantissa >> 13)) + ((mantissa >> 12) & 1));
+	}
+
+	float fromHalf(const uint16_t half)
+	{
+		const uint32_t sign = static_cast<uint32_t>(half & 0x8000) << 16;
+		const uint32_t exponent = (half >> 10) & 0x1f;
+		const uint32_t mantissa = half & 0x3ff;
+		uint32_t bits = sign;
+		if (exponent == 31) {
+			bits |= 0x7f800000 | (mantissa << 13);
+		}
+		else if (exponent != 0) {
+			bits |= ((exponent - 15 + 127) << 23) | (mantissa << 13);
+		}
+		float value;
+		memcpy(&value, &bits, sizeof value);
+		return value;
+	}
+}
+
+FrameHistory::FrameHistory(const int pixelCount, const HistoryParams & params) : params(params), pixelCount(pixelCount),
+	endIndex(0), memoryUsage(0), decodedKey(UINT64_MAX)
+{
+}
+
+void FrameHistory::Reset()
+{
+	chunks.clear();
+	endIndex = 0;
+	memoryUsage = 0;
+	decodedKey = UINT64_MAX;
+}
+
+void FrameHistory::Reset(const int newPixelCount)
+{
+	pixelCount = newPixelCount;
+	Reset();
+}
+
+// Codes are unsigned and ordered like the temperatures, so differences
+// between them are small for similar temperatures.
+uint32_t FrameHistory::Encode(const float temperature) const
+{
+	if (params.encoding == HistoryEncoding::Packed12) {
+		const long q = lroundf(temperature * 4);
+		return static_cast<uint32_t>(std::max(-2048L, std::min(2047L, q)) + 2048);
+	}
+	const uint16_t half = toHalf(temperature);
+	return (half & 0x8000) ? (~half & 0xffff) : (half | 0x8000);
+}
+
+float FrameHistory::Decode(const uint32_t code) const
+{
+	if (params.encoding == HistoryEncoding::Packed12) {
+		return (static_cast<int>(code) - 2048) / 4.0f;
+	}
+	return fromHalf(static_cast<uint16_t>((code & 0x8000) ? (code & 0x7fff) : (~code & 0xffff)));
+}
+
+void FrameHistory::Append(const float * temperatures, const double timestamp)
+{
+	codes.resize(pixelCount);
+	for (int i = 0; i < pixelCount; ++i) {
+		codes[i] = Encode(temperatures[i]);
+	}
+
+	// the timestamp check keeps the ms offsets of a chunk in range
+	if (chunks.empty() || chunks.back().Frames() >= static_cast<size_t>(params.chunkFrames) ||
+		timestamp - chunks.back().firstTimestamp >= UINT32_MAX / 1000.0) {
+		if (!chunks.empty()) {
+			// the chunk is complete, give back the slack of its buffers
+			Chunk & last = chunks.back();
+			memoryUsage -= last.Bytes();
+			last.data.shrink_to_fit();
+			last.timeOffsets.shrink_to_fit();
+			last.frameOffsets.shrink_to_fit();
+			memoryUsage += last.Bytes();
+		}
+
+		chunks.emplace_back();
+		Chunk & chunk = chunks.back();
+		chunk.firstIndex = endIndex;
+		chunk.firstTimestamp = timestamp;
+		chunk.timeOffsets.reserve(params.chunkFrames);
+		chunk.frameOffsets.reserve(params.chunkFrames);
+		chunk.timeOffsets.push_back(0);
+		chunk.frameOffsets.push_back(0);
+
+		BitWriter writer(chunk.data);
+		for (const uint32_t c : codes) {
+			writer.Write(c, KeyBits());
+		}
+		writer.Flush();
+		key = codes;
+		memoryUsage += chunk.Bytes();
+	}
+	else {
+		Chunk & chunk = chunks.back();
+		memoryUsage -= chunk.Bytes();
+
+		uint32_t largest = 0;
+		for (int i = 0; i < pixelCount; ++i) {
+			codes[i] = zigzag(static_cast<int32_t>(codes[i] - key[i]));
+			largest |= codes[i];
+		}
+		int width = 0;
+		while (width < 32 && (largest >> width) != 0) {
+			width++;
+		}
+
+		chunk.timeOffsets.push_back(static_cast<uint32_t>(llround((timestamp - chunk.firstTimestamp) * 1000)));
+		chunk.frameOffsets.push_back(static_cast<uint32_t>(chunk.data.size()));
+		chunk.data.push_back(static_cast<uint8_t>(width));
+		if (width > 0) {
+			BitWriter writer(chunk.data);
+			for (const uint32_t c : codes) {
+				writer.Write(c, width);
+			}
+			writer.Flush();
+		}
+		memoryUsage += chunk.Bytes();
+	}
+
+	endIndex++;
+	Trim();
+}
+
+void FrameHistory::Trim()
+{
+	// the chunk being written is always kept
+	while (memoryUsage > params.memoryLimit && chunks.size() > 1) {
+		if (decodedKey == chunks.front().firstIndex) {
+			decodedKey = UINT64_MAX;
+		}
+		memoryUsage -= chunks.front().Bytes();
+		chunks.pop_front();
+	}
+}
+
+uint64_t FrameHistory::FirstIndex() const
+{
+	return chunks.empty() ? endIndex : chunks.front().firstIndex;
+}
+
+const FrameHistory::Chunk * FrameHistory::ChunkFor(const uint64_t index) const
+{
+	if (index < FirstIndex() || index >= endIndex) {
+		return nullptr;
+	}
+	// all chunks but the last are full, unless a timestamp gap closed one
+	// early, so search for it
+	const auto next = std::upper_bound(chunks.begin(), chunks.end(), index,
+		[](const uint64_t i, const Chunk & c) { return i < c.firstIndex; });
+	return &*(next - 1);
+}
+
+double FrameHistory::Timestamp(const uint64_t index) const
+{
+	const Chunk * chunk = ChunkFor(index);
+	if (!chunk) {
+		return 0;
+	}
+	return chunk->firstTimestamp + chunk->timeOffsets[index - chunk->firstIndex] / 1000.0;
+}
+
+bool FrameHistory::Find(const double timestamp, uint64_t * index) const
+{
+	const auto next = std::upper_bound(chunks.begin(), chunks.end(), timestamp,
+		[](const double t, const Chunk & c) { return t < c.firstTimestamp; });
+	if (next == chunks.begin()) {
+		return false;
+	}
+	const Chunk & chunk = *(next - 1);
+	const double offset = (timestamp - chunk.firstTimestamp) * 1000;
+	const auto frame = std::upper_bound(chunk.timeOffsets.begin(), chunk.timeOffsets.end(), offset,
+		[](const double t, const uint32_t o) { return t < o; });
+	*index = chunk.firstIndex + (frame - chunk.timeOffsets.begin()) - 1;
+	return true;
+}
+
+bool FrameHistory::Read(const uint64_t index, float * temperatures)
+{
+	const Chunk * chunk = ChunkFor(index);
+	if (!chunk) {
+		return false;
+	}
+
+	if (decodedKey != chunk->firstIndex) {
+		decodedCodes.resize(pixelCount);
+		BitReader reader(chunk->data.data());
+		for (int i = 0; i < pixelCount; ++i) {
+			decodedCodes[i] = reader.Read(KeyBits());
+		}
+		decodedKey = chunk->firstIndex;
+	}
+
+	const size_t frame = static_cast<size_t>(index - chunk->firstIndex);
+	if (frame == 0) {
+		for (int i = 0; i < pixelCount; ++i) {
+			temperatures[i] = Decode(decodedCodes[i]);
+		}
+		return true;
+	}
+
+	const uint8_t * data = chunk->data.data() + chunk->frameOffsets[frame];
+	const int width = *data++;
+	BitReader reader(data);
+	for (int i = 0; i < pixelCount; ++i) {
+		const int32_t difference = width > 0 ? unzigzag(reader.Read(width)) : 0;
+		temperatures[i] = Decode(decodedCodes[i] + difference);
+	}
+	return true;
+}
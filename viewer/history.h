@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Recent frames of one sensor, kept compressed in memory so the live view
+// can be rewound after an alarm.
+//
+// Temperatures are quantized to 12 bit (0.25 degC steps, -512 to 511.75
+// degC, the AMG88xx resolution) or to half floats, then stored in chunks of
+// a fixed number of frames. The first frame of a chunk is stored as is, the
+// others as bit packed differences to it, with the smallest bit width their
+// largest difference needs. Any frame is decoded from its chunk's key frame
+// and its own differences, the key frame being decoded once and kept for
+// scrubbing within the chunk. Nothing is decoded while recording.
+//
+// The oldest chunks are dropped when the history grows past its memory
+// limit. Frames are addressed by an index counting all frames appended
+// since the last reset, or found by timestamp.
+
+enum class HistoryEncoding
+{
+	Packed12, // 0.25 degC steps
+	Half,     // IEEE 754 half precision
+};
+
+struct HistoryParams
+{
+	size_t memoryLimit = 256 * 1024; // bytes, per sensor
+	int chunkFrames = 64;            // frames per chunk
+	HistoryEncoding encoding = HistoryEncoding::Packed12;
+};
+
+class FrameHistory
+{
+public:
+	explicit FrameHistory(int pixelCount = 64, const HistoryParams & params = HistoryParams());
+
+	const HistoryParams & Params() const { return params; }
+	void Reset();
+	void Reset(int pixelCount);
+
+	// timestamp in seconds, not decreasing
+	void Append(const float * temperatures, double timestamp);
+
+	// Indices of the frames still available, [FirstIndex(), EndIndex()).
+	uint64_t FirstIndex() const;
+	uint64_t EndIndex() const { return endIndex; }
+	bool Empty() const { return chunks.empty(); }
+
+	double Timestamp(uint64_t index) const;
+
+	// The last frame at or before timestamp, false if all are newer.
+	bool Find(double timestamp, uint64_t * index) const;
+
+	// temperatures: pixelCount values. False if the frame is no longer (or
+	// not yet) available.
+	bool Read(uint64_t index, float * temperatures);
+
+	size_t MemoryUsage() const { return memoryUsage; }
+
+private:
+	struct Chunk
+	{
+		uint64_t firstIndex;
+		double firstTimestamp;
+		std::vector<uint32_t> timeOffsets;  // ms since firstTimestamp, per frame
+		std::vector<uint32_t> frameOffsets; // byte offset in data, per frame
+		std::vector<uint8_t> data;
+
+		size_t Frames() const { return frameOffsets.size(); }
+		size_t Bytes() const { return sizeof(Chunk) + (timeOffsets.capacity() + frameOffsets.capacity()) * sizeof(uint32_t) + data.capacity(); }
+	};
+
+	uint32_t Encode(float temperature) const;
+	float Decode(uint32_t code) const;
+	int KeyBits() const { return params.encoding == HistoryEncoding::Packed12 ? 12 : 16; }
+	const Chunk * ChunkFor(uint64_t index) const;
+	void Trim();
+
+	HistoryParams params;
+	int pixelCount;
+	std::deque<Chunk> chunks;
+	uint64_t endIndex;
+	size_t memoryUsage;
+
+	std::vector<uint32_t> key;        // codes of the key frame of the last chunk
+	std::vector<uint32_t> codes;      // scratch
+	uint64_t decodedKey;              // firstIndex of the chunk whose key frame is in decodedCodes, or UINT64_MAX
+	std::vector<uint32_t> decodedCodes;
+};
@@ -0,0 +1,183 @@
+#include "pch.h"
+#include "hotspot.h"
+#include "resample.h"
+
+HotspotTracker::HotspotTracker(const HotspotParams & params, const SensorGeometry & geometry) : params(params),
+	plan(getResamplePlan(geometry, params.resolution, params.resolution)),
+	lastTimestamp(0), fieldWidth(0), fieldHeight(0), nextId(1)
+{
+}
+
+void HotspotTracker::Reset()
+{
+	tracks.clear();
+}
+
+const std::vector<Hotspot> & HotspotTracker::UpdateFromSamples(const std::vector<float> & samples, const double timestamp)
+{
+	field.resize(params.resolution * params.resolution);
+	plan->Apply(samples.data(), field.data(), horizontal);
+	return Update(field.data(), params.resolution, params.resolution, timestamp);
+}
+
+const std::vector<Hotspot> & HotspotTracker::Update(const float * input, const int width, const int height, const double timestamp)
+{
+	fieldWidth = width;
+	fieldHeight = height;
+	Label(input, width, height);
+	Match(timestamp);
+	lastTimestamp = timestamp;
+	return tracks;
+}
+
+int HotspotTracker::Find(int label)
+{
+	// path halving
+	while (parent[label] != label) {
+		parent[label] = parent[parent[label]];
+		label = parent[label];
+	}
+	return label;
+}
+
+void HotspotTracker::Label(const float * input, const int width, const int height)
+{
+	const int count = width * height;
+
+	float threshold = params.threshold;
+	if (params.minContrast > 0) {
+		double sum = 0;
+		for (int i = 0; i < count; ++i) {
+			sum += input[i];
+		}
+		threshold = std::max(threshold, static_cast<float>(sum / count) + params.minContrast);
+	}
+
+	// first pass: provisional labels, merging with the already visited
+	// neighbours (left, up-left, up, up-right). Label 0 is background.
+	labels.assign(count, 0);
+	parent.clear();
+	parent.push_back(0);
+	for (int row = 0; row < height; ++row) {
+		for (int col = 0; col < width; ++col) {
+			const int i = row * width + col;
+			if (input[i] < threshold) {
+				continue;
+			}
+
+			int label = 0;
+			const int neighbours[4] = {
+				col > 0 ? labels[i - 1] : 0,
+				row > 0 && col > 0 ? labels[i - width - 1] : 0,
+				row > 0 ? labels[i - width] : 0,
+				row > 0 && col < width - 1 ? labels[i - width + 1] : 0,
+			};
+			for (const int n : neighbours) {
+				if (n == 0) {
+					continue;
+				}
+				const int root = Find(n);
+				if (label == 0) {
+					label = root;
+				}
+				else if (root != label) {
+					// keep the smaller root, so roots stay in first-seen order
+					parent[std::max(root, label)] = std::min(root, label);
+					label = std::min(root, label);
+				}
+			}
+			if (label == 0) {
+				label = static_cast<int>(parent.size());
+				parent.push_back(label);
+			}
+			labels[i] = label;
+		}
+	}
+
+	// second pass: accumulate region statistics per root
+	blobs.assign(parent.size(), Blob{ 0, 0, 0, -INFINITY, false });
+	for (int row = 0; row < height; ++row) {
+		for (int col = 0; col < width; ++col) {
+			const int i = row * width + col;
+			if (labels[i] == 0) {
+				continue;
+			}
+			Blob & b = blobs[Find(labels[i])];
+			b.pixels++;
+			b.sum_x += col + 0.5f;
+			b.sum_y += row + 0.5f;
+			b.peak = std::max(b.peak, input[i]);
+		}
+	}
+}
+
+void HotspotTracker::Match(const double timestamp)
+{
+	const double dt = timestamp - lastTimestamp;
+
+	// candidate pairs of existing tracks and new regions, closest first
+	candidates.clear();
+	for (int b = 1; b < static_cast<int>(blobs.size()); ++b) {
+		const Blob & blob = blobs[b];
+		if (blob.pixels < params.minPixels) {
+			continue;
+		}
+		const float x = blob.sum_x / blob.pixels / fieldWidth;
+		const float y = blob.sum_y / blob.pixels / fieldHeight;
+		for (int t = 0; t < static_cast<int>(tracks.size()); ++t) {
+			const float d = hypot(tracks[t].x - x, tracks[t].y - y);
+			if (d <= params.maxMatchDistance) {
+				candidates.push_back({ d, { t, b } });
+			}
+		}
+	}
+	std::sort(candidates.begin(), candidates.end());
+
+	for (auto & track : tracks) {
+		track.missedFrames++;
+	}
+
+	for (const auto & c : candidates) {
+		Hotspot & track = tracks[c.second.first];
+		Blob & blob = blobs[c.second.second];
+		if (track.missedFrames == 0 || blob.matched) {
+			continue; // one side already taken by a closer pair
+		}
+		const float x = blob.sum_x / blob.pixels / fieldWidth;
+		const float y = blob.sum_y / blob.pixels / fieldHeight;
+		if (dt > 0) {
+			// smooth the velocity, centroids jitter by a fraction of a pixel
+			const int frames = track.missedFrames;
+			track.vx = 0.5f * track.vx + 0.5f * static_cast<float>((x - track.x) / (dt * frames));
+			track.vy = 0.5f * track.vy + 0.5f * static_cast<float>((y - track.y) / (dt * frames));
+		}
+		track.x = x;
+		track.y = y;
+		track.area = static_cast<float>(blob.pixels) / (fieldWidth * fieldHeight);
+		track.peak = blob.peak;
+		track.age++;
+		track.missedFrames = 0;
+		blob.matched = true;
+	}
+
+	tracks.erase(std::remove_if(tracks.begin(), tracks.end(),
+		[this](const Hotspot & t) { return t.missedFrames > params.maxMissedFrames; }), tracks.end());
+
+	for (int b = 1; b < static_cast<int>(blobs.size()); ++b) {
+		const Blob & blob = blobs[b];
+		if (blob.pixels < params.minPixels || blob.matched) {
+			continue;
+		}
+		Hotspot track;
+		track.id = nextId++;
+		track.x = blob.sum_x / blob.pixels / fieldWidth;
+		track.y = blob.sum_y / blob.pixels / fieldHeight;
+		track.area = static_cast<float>(blob.pixels) / (fieldWidth * fieldHeight);
+		track.peak = blob.peak;
+		track.vx = 0;
+		track.vy = 0;
+		track.age = 0;
+		track.missedFrames = 0;
+		tracks.push_back(track);
+	}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "geometry.h"
+
+class ResamplePlan;
+
+// Finds connected hot regions in the interpolated field of a frame, and
+// tracks them across frames with stable ids.
+//
+// Regions are found by thresholding, then labeling 8-connected pixels with
+// a union-find pass. All buffers, the resampling pass included, are kept
+// between frames, so a tracker per sensor does no allocations in steady
+// state. The field can be evaluated at a reduced resolution to cut the
+// cost further.
+//
+// Positions, areas and velocities are normalized to the sensor's field of
+// view, (0, 0) being the top left corner and (1, 1) the bottom right one.
+
+struct HotspotParams
+{
+	float threshold = 30.0f;      // degC, pixels at or above are hot
+	float minContrast = 0.0f;     // degC above the frame mean a pixel must also be, 0 = off
+	int resolution = 32;          // field size used by UpdateFromSamples
+	int minPixels = 3;            // smaller regions are ignored
+	float maxMatchDistance = 0.2f; // max centroid travel between frames to keep the id
+	int maxMissedFrames = 5;      // tracks not seen for longer are dropped
+};
+
+struct Hotspot
+{
+	int id;
+	float x;              // centroid
+	float y;
+	float area;           // fraction of the field of view
+	float peak;           // degC
+	float vx;             // field of view per second
+	float vy;
+	int age;              // frames since first seen
+	int missedFrames;     // frames since last seen, 0 if seen in the current one
+};
+
+class HotspotTracker
+{
+public:
+	explicit HotspotTracker(const HotspotParams & params = HotspotParams(), const SensorGeometry & geometry = amg88xx_geometry);
+
+	// field: width * height temperatures, row by row. timestamp in seconds.
+	const std::vector<Hotspot> & Update(const float * field, int width, int height, double timestamp);
+	const std::vector<Hotspot> & Update(const float * field, int size, double timestamp) { return Update(field, size, size, timestamp); }
+
+	// Resamples the source samples to params.resolution first.
+	const std::vector<Hotspot> & UpdateFromSamples(const std::vector<float> & samples, double timestamp);
+
+	const std::vector<Hotspot> & Tracks() const { return tracks; }
+	void Reset();
+
+private:
+	struct Blob
+	{
+		int pixels;
+		float sum_x;
+		float sum_y;
+		float peak;
+		bool matched;
+	};
+
+	int Find(int label);
+	void Label(const float * field, int width, int height);
+	void Match(double timestamp);
+
+	HotspotParams params;
+	std::shared_ptr<const ResamplePlan> plan;
+	std::vector<float> field;
+	std::vector<float> horizontal; // resample pass
+	std::vector<int> labels;
+	std::vector<int> parent;
+	std::vector<Blob> blobs;
+	std::vector<Hotspot> tracks;
+	std::vector<std::pair<float, std::pair<int, int>>> candidates;
+	double lastTimestamp;
+	int fieldWidth;
+	int fieldHeight;
+	int nextId;
+};
@@ -0,0 +1,218 @@
+#include "pch.h"
+#include "isotherm.h"
+#include "resample.h"
+
+IsothermExtractor::IsothermExtractor(const int resolution, const SensorGeometry & geometry) : resolution(resolution),
+	geometry(geometry), plan(getResamplePlan(geometry, resolution, resolution)), horizontal(geometry.height * resolution, 0.0f),
+	values(resolution * resolution, 0.0f), valueStamps(resolution * resolution, 0),
+	edgeStamps(resolution * resolution * 2, 0), frameStamp(0), levelStamp(0), evaluated(0), level(0)
+{
+}
+
+void IsothermExtractor::SetFrame(const std::vector<float> & samples)
+{
+	assert(samples.size() == static_cast<size_t>(geometry.PixelCount()));
+
+	// The horizontal pass is linear in the resolution, the vertical one is
+	// done per grid point on demand.
+	for (int source_row = 0; source_row < geometry.height; ++source_row) {
+		const float * in = samples.data() + source_row * geometry.width;
+		for (int col = 0; col < resolution; ++col) {
+			const ResamplePlan::Tap & t = plan->ColumnTap(col);
+			float accumulator = 0;
+			for (int k = 0; k < plan->TapCount(); ++k) {
+				accumulator += in[t.index[k]] * t.weight[k];
+			}
+			horizontal[source_row * resolution + col] = accumulator;
+		}
+	}
+
+	frameStamp++;
+	evaluated = 0;
+}
+
+float IsothermExtractor::Value(const int row, const int col)
+{
+	const int i = row * resolution + col;
+	if (valueStamps[i] != frameStamp) {
+		const ResamplePlan::Tap & t = plan->RowTap(row);
+		float accumulator = 0;
+		for (int k = 0; k < plan->TapCount(); ++k) {
+			accumulator += horizontal[t.index[k] * resolution + col] * t.weight[k];
+		}
+		values[i] = accumulator;
+		valueStamps[i] = frameStamp;
+		evaluated++;
+	}
+	return values[i];
+}
+
+// Edges are shared by neighbouring cells: the top edge of a cell is the
+// horizontal edge starting at its top left grid point, the left edge the
+// vertical one. Bottom and right edges belong to the neighbours.
+int IsothermExtractor::EdgeId(const int row, const int col, const Edge edge) const
+{
+	switch (edge) {
+	case Top: return (row * resolution + col) * 2;
+	case Bottom: return ((row + 1) * resolution + col) * 2;
+	case Left: return (row * resolution + col) * 2 + 1;
+	default: return (row * resolution + col + 1) * 2 + 1;
+	}
+}
+
+IsothermPoint IsothermExtractor::Crossing(const int row, const int col, const Edge edge)
+{
+	int r0 = row, c0 = col, r1 = row, c1 = col;
+	switch (edge) {
+	case Top: c1++; break;
+	case Bottom: r0++; r1++; c1++; break;
+	case Left: r1++; break;
+	case Right: c0++; c1++; r1++; break;
+	}
+	const float v0 = Value(r0, c0);
+	const float v1 = Value(r1, c1);
+	const float t = (level - v0) / (v1 - v0);
+	return IsothermPoint{
+		(c0 + t * (c1 - c0) + 0.5f) / resolution,
+		(r0 + t * (r1 - r0) + 0.5f) / resolution,
+	};
+}
+
+// Marching squares: the edge through which the contour leaves the cell,
+// having entered through the given one.
+IsothermExtractor::Edge IsothermExtractor::Exit(const int row, const int col, const Edge entry)
+{
+	const bool tl = Inside(row, col);
+	const bool tr = Inside(row, col + 1);
+	const bool br = Inside(row + 1, col + 1);
+	const bool bl = Inside(row + 1, col);
+	const bool crossed[4] = { tl != tr, tr != br, bl != br, tl != bl };
+
+	const int crossings = crossed[Top] + crossed[Right] + crossed[Bottom] + crossed[Left];
+	if (crossings == 4) {
+		// saddle, decided by the value at the center of the cell
+		const float center = (Value(row, col) + Value(row, col + 1) + Value(row + 1, col) + Value(row + 1, col + 1)) / 4;
+		if ((center >= level) == tl) {
+			// tl and br are connected, contours cut off tr and bl
+			switch (entry) {
+			case Top: return Right;
+			case Right: return Top;
+			case Bottom: return Left;
+			default: return Bottom;
+			}
+		}
+		switch (entry) {
+		case Top: return Left;
+		case Left: return Top;
+		case Bottom: return Right;
+		default: return Bottom;
+		}
+	}
+
+	for (int e = Top; e <= Left; ++e) {
+		if (crossed[e] && e != entry) {
+			return static_cast<Edge>(e);
+		}
+	}
+	assert(false);
+	return entry;
+}
+
+// Walks the contour from a cell it enters through the given edge, until it
+// leaves the grid or closes. Returns true if it closed.
+bool IsothermExtractor::Follow(int row, int col, Edge entry, std::vector<IsothermPoint> & points)
+{
+	const int last = resolution - 2; // last cell index on both axes
+	while (row >= 0 && row <= last && col >= 0 && col <= last) {
+		const Edge exit = Exit(row, col, entry);
+		const int id = EdgeId(row, col, exit);
+		if (edgeStamps[id] == levelStamp) {
+			points.push_back(Crossing(row, col, exit));
+			return true;
+		}
+		edgeStamps[id] = levelStamp;
+		points.push_back(Crossing(row, col, exit));
+
+		switch (exit) {
+		case Top: row--; entry = Bottom; break;
+		case Bottom: row++; entry = Top; break;
+		case Left: col--; entry = Right; break;
+		case Right: col++; entry = Left; break;
+		}
+	}
+	return false;
+}
+
+// Starts a contour at a crossed edge not visited yet. (row, col) is the cell
+// the edge belongs to as its top or left edge, it may lie past the last cell
+// on the bottom or right border of the grid.
+void IsothermExtractor::Trace(const int row, const int col, const Edge edge)
+{
+	const int id = EdgeId(row, col, edge);
+	if (edgeStamps[id] == levelStamp) {
+		return;
+	}
+	edgeStamps[id] = levelStamp;
+
+	IsothermLine line;
+	line.level = level;
+	line.points.push_back(Crossing(row, col, edge));
+
+	// one direction goes into the cell below/right of the edge, the other
+	// into the one above/left
+	const bool forward_closed = Follow(row, col, edge, line.points);
+	line.closed = forward_closed;
+	if (!forward_closed) {
+		backward.clear();
+		if (edge == Top) {
+			Follow(row - 1, col, Bottom, backward);
+		}
+		else {
+			Follow(row, col - 1, Right, backward);
+		}
+		line.points.insert(line.points.begin(), backward.rbegin(), backward.rend());
+	}
+
+	if (line.points.size() > 1) {
+		lines.push_back(std::move(line));
+	}
+}
+
+void IsothermExtractor::ScanSeeds()
+{
+	// seed lines every half sensor pixel, and the borders
+	const int step = std::max(1, resolution / (std::max(geometry.width, geometry.height) * 2));
+	std::vector<int> seeds;
+	for (int i = 0; i < resolution; i += step) {
+		seeds.push_back(i);
+	}
+	if (seeds.back() != resolution - 1) {
+		seeds.push_back(resolution - 1);
+	}
+
+	for (const int row : seeds) {
+		for (int col = 0; col + 1 < resolution; ++col) {
+			if (Inside(row, col) != Inside(row, col + 1)) {
+				Trace(row, col, Top);
+			}
+		}
+	}
+	for (const int col : seeds) {
+		for (int row = 0; row + 1 < resolution; ++row) {
+			if (Inside(row, col) != Inside(row + 1, col)) {
+				Trace(row, col, Left);
+			}
+		}
+	}
+}
+
+const std::vector<IsothermLine> & IsothermExtractor::Extract(const std::vector<float> & levels)
+{
+	lines.clear();
+	for (const float l : levels) {
+		level = l;
+		levelStamp++;
+		ScanSeeds();
+	}
+	return lines;
+}
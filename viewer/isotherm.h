@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "geometry.h"
+
+class ResamplePlan;
+
+// Isotherm lines of a frame, extracted with marching squares on the grid of
+// the image resampleThermalImage would render at the given resolution, so
+// lines match that image at any scale.
+//
+// Grid values are evaluated lazily from the plan tables. Contours are found
+// by scanning seed lines every half sensor pixel, and then followed cell by
+// cell, so the work grows with the length of the contours rather than with
+// the area of the image. Islands smaller than half a sensor pixel in both
+// directions can fall between seed lines and are not reported.
+//
+// Points are normalized to the sensor's field of view, (0, 0) being the top
+// left corner and (1, 1) the bottom right one.
+
+struct IsothermPoint
+{
+	float x;
+	float y;
+};
+
+struct IsothermLine
+{
+	float level;
+	bool closed;
+	std::vector<IsothermPoint> points;
+};
+
+class IsothermExtractor
+{
+public:
+	explicit IsothermExtractor(int resolution = 100, const SensorGeometry & geometry = amg88xx_geometry);
+
+	int Resolution() const { return resolution; }
+
+	// Takes the decoded source samples of a new frame.
+	void SetFrame(const std::vector<float> & samples);
+
+	const std::vector<IsothermLine> & Extract(const std::vector<float> & levels);
+
+	// Number of grid values evaluated for the current frame.
+	size_t EvaluatedPoints() const { return evaluated; }
+
+private:
+	enum Edge { Top, Right, Bottom, Left };
+
+	float Value(int row, int col);
+	bool Inside(int row, int col) { return Value(row, col) >= level; }
+	int EdgeId(int row, int col, Edge edge) const;
+	IsothermPoint Crossing(int row, int col, Edge edge);
+	Edge Exit(int row, int col, Edge entry);
+	void Trace(int row, int col, Edge edge);
+	bool Follow(int row, int col, Edge entry, std::vector<IsothermPoint> & points);
+	void ScanSeeds();
+
+	int resolution;
+	SensorGeometry geometry;
+	std::shared_ptr<const ResamplePlan> plan;
+	std::vector<float> horizontal; // source rows resampled to the grid columns
+	std::vector<float> values;
+	std::vector<uint32_t> valueStamps;
+	std::vector<uint32_t> edgeStamps;
+	uint32_t frameStamp;
+	uint32_t levelStamp;
+	size_t evaluated;
+	float level;
+	std::vector<IsothermLine> lines;
+	std::vector<IsothermPoint> backward;
+};
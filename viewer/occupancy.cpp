@@ -0,0 +1,104 @@
+#include "pch.h"
+#include "occupancy.h"
+
+static const uint64_t not_first_col = 0xfefefefefefefefeull;
+static const uint64_t not_last_col = 0x7f7f7f7f7f7f7f7full;
+static const float initial_variance = 0.09f; // sensor noise, 0.3 degC std dev
+
+// grows the mask by one pixel in all 8 directions
+static uint64_t dilate(uint64_t mask)
+{
+	mask |= ((mask << 1) & not_first_col) | ((mask >> 1) & not_last_col);
+	return mask | (mask << 8) | (mask >> 8);
+}
+
+OccupancyDetector::OccupancyDetector(const OccupancyParams & params) : params(params)
+{
+	Reset();
+}
+
+void OccupancyDetector::SetParams(const OccupancyParams & newParams)
+{
+	params = newParams;
+}
+
+void OccupancyDetector::Reset()
+{
+	result = OccupancyResult{ 0, 0, 0, false, true };
+	frames = 0;
+	std::fill(std::begin(background), std::end(background), 0.0f);
+	std::fill(std::begin(variance), std::end(variance), initial_variance);
+}
+
+int OccupancyDetector::Popcount(uint64_t mask)
+{
+	mask = mask - ((mask >> 1) & 0x5555555555555555ull);
+	mask = (mask & 0x3333333333333333ull) + ((mask >> 2) & 0x3333333333333333ull);
+	mask = (mask + (mask >> 4)) & 0x0f0f0f0f0f0f0f0full;
+	return static_cast<int>((mask * 0x0101010101010101ull) >> 56);
+}
+
+const OccupancyResult & OccupancyDetector::Update(const float * temperatures)
+{
+	if (frames < params.learningFrames) {
+		// plain average of the first frames
+		++frames;
+		const float rate = 1.0f / frames;
+		for (int i = 0; i < 64; ++i) {
+			background[i] += (temperatures[i] - background[i]) * rate;
+		}
+		result.learning = true;
+		return result;
+	}
+
+	const float threshold2 = params.threshold * params.threshold;
+	const float noiseFactor2 = params.noiseFactor * params.noiseFactor;
+	uint64_t mask = 0;
+	for (int i = 0; i < 64; ++i) {
+		const float d = temperatures[i] - background[i];
+		const float d2 = d * d;
+		const bool foreground = d > 0 && d2 > threshold2 && d2 > noiseFactor2 * variance[i];
+		if (foreground) {
+			mask |= 1ull << i;
+			background[i] += d * params.foregroundRate;
+		}
+		else {
+			background[i] += d * params.backgroundRate;
+			variance[i] += (d2 - variance[i]) * params.backgroundRate;
+		}
+	}
+
+	const uint64_t changed = mask ^ result.foreground;
+	const int previousPeople = result.people;
+	Count(mask);
+	result.motion = !result.learning && (Popcount(changed) >= params.motionPixels || result.people != previousPeople);
+	result.foreground = mask;
+	result.learning = false;
+	return result;
+}
+
+void OccupancyDetector::Count(uint64_t mask)
+{
+	result.regions = 0;
+	result.people = 0;
+
+	while (mask) {
+		// flood fill from the lowest set pixel
+		uint64_t region = mask & (~mask + 1);
+		for (;;) {
+			const uint64_t grown = dilate(region) & mask;
+			if (grown == region) {
+				break;
+			}
+			region = grown;
+		}
+		mask &= ~region;
+
+		const int pixels = Popcount(region);
+		if (pixels < params.minPixels) {
+			continue;
+		}
+		++result.regions;
+		result.people += std::max(1, static_cast<int>(pixels / params.pixelsPerPerson + 0.5f));
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+
+// Presence detection working directly on the 64 source samples, for
+// deployments which only need to know if and how many people are in view,
+// not an image. Nothing is resampled or colorized.
+//
+// Every pixel keeps a slowly adapting background temperature and noise
+// variance. Pixels sufficiently warmer than their background form the
+// foreground mask, held as one bit per pixel (bit row * 8 + col), so region
+// labeling and motion detection are a handful of 64 bit operations. State
+// is about 1 KB and an update well under a microsecond, one core can keep up
+// with thousands of sensors.
+
+struct OccupancyParams
+{
+	int learningFrames = 20;         // frames averaged into the initial background
+	float backgroundRate = 0.02f;    // adaptation rate of background pixels
+	float foregroundRate = 0.0005f;  // adaptation rate of foreground pixels, absorbs left behind warm objects
+	float threshold = 1.5f;          // degC above the background a foreground pixel must at least be
+	float noiseFactor = 3.0f;        // ... and this many standard deviations of the pixel noise
+	int minPixels = 1;               // smaller regions are ignored
+	float pixelsPerPerson = 4.0f;    // typical area of one person, larger regions count as several
+	int motionPixels = 2;            // foreground pixels appearing or vanishing that make a motion event
+};
+
+struct OccupancyResult
+{
+	uint64_t foreground; // mask, bit row * 8 + col
+	int regions;
+	int people;          // estimate
+	bool motion;
+	bool learning;       // background still being built, nothing detected yet
+};
+
+class OccupancyDetector
+{
+public:
+	explicit OccupancyDetector(const OccupancyParams & params = OccupancyParams());
+
+	void SetParams(const OccupancyParams & params);
+	const OccupancyParams & Params() const { return params; }
+	void Reset();
+
+	// temperatures: the 64 decoded samples of a frame, in degC.
+	const OccupancyResult & Update(const float * temperatures);
+	const OccupancyResult & Result() const { return result; }
+
+	static int Popcount(uint64_t mask);
+
+private:
+	void Count(uint64_t mask);
+
+	OccupancyParams params;
+	OccupancyResult result;
+	float background[64];
+	float variance[64];
+	int frames;
+};
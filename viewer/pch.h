@@ -18,7 +18,12 @@
 #include <winrt/Windows.Devices.Bluetooth.Advertisement.h>
 #include <winrt/Windows.Devices.Bluetooth.GenericAttributeProfile.h>
 #include <winrt/Windows.Devices.Enumeration.h>
+#include <winrt/Windows.Graphics.Display.h>
 #include <winrt/Windows.Graphics.Imaging.h>
+#include <winrt/Windows.Networking.Sockets.h>
+#include <winrt/Windows.Security.Cryptography.h>
+#include <winrt/Windows.Security.Cryptography.Core.h>
+#include <winrt/Windows.Storage.h>
 #include <winrt/Windows.Storage.Streams.h>
 #include <winrt/Windows.System.Display.h>
 #include <winrt/Windows.System.Threading.h>
@@ -36,6 +41,12 @@
 #include "winrt/Windows.UI.Xaml.Navigation.h"
 
 #include <set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <tuple>
+#include <vector>
 #include <algorithm>
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -0,0 +1,57 @@
+#include "pch.h"
+#include "pyramid.h"
+
+ZoomPyramid::ZoomPyramid(const int maxWidth, const ResampleKernel kernel) : maxWidth(maxWidth), kernel(kernel),
+	geometry{ 0, 0 }, frameStamp(0), computed(0)
+{
+}
+
+void ZoomPyramid::SetFrame(const float * newSamples, const SensorGeometry & newGeometry)
+{
+	if (newGeometry != geometry) {
+		geometry = newGeometry;
+		levels.clear();
+		for (int level = 0; level == 0 || LevelWidth(level) <= maxWidth; ++level) {
+			levels.push_back(LevelData{ nullptr, {}, 0 });
+		}
+	}
+
+	samples.assign(newSamples, newSamples + geometry.PixelCount());
+	frameStamp++;
+	computed = 0;
+}
+
+int ZoomPyramid::LevelFor(const int width) const
+{
+	for (int level = 0; level < LevelCount(); ++level) {
+		if (LevelWidth(level) >= width) {
+			return level;
+		}
+	}
+	return LevelCount() - 1;
+}
+
+const float * ZoomPyramid::Level(const int level)
+{
+	if (level == 0) {
+		return samples.data();
+	}
+
+	LevelData & data = levels[level];
+	if (data.stamp != frameStamp) {
+		if (!data.plan) {
+			data.plan = getResamplePlan(geometry, LevelWidth(level), LevelHeight(level), kernel);
+		}
+		data.values.resize(static_cast<size_t>(LevelWidth(level)) * LevelHeight(level));
+		data.plan->Apply(samples.data(), data.values.data(), horizontal);
+		data.stamp = frameStamp;
+		computed++;
+	}
+	return data.values.data();
+}
+
+void ZoomPyramid::Region(const int zoom_width, const int col_begin, const int col_end, const int row_begin, const int row_end, float * output)
+{
+	const auto plan = getResamplePlan(geometry, zoom_width, geometry.ScaledHeight(zoom_width), kernel);
+	plan->ApplyRect(samples.data(), output, horizontal, col_begin, col_end, row_begin, row_end);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "geometry.h"
+#include "resample.h"
+
+// Zoom levels of the current frame for pan/zoom views and thumbnail
+// grids, so consumers at different sizes share resampled images instead of
+// each resampling the frame on every update.
+//
+// Level k is the sensor image scaled 2^k times in both directions, level 0
+// being the source samples themselves. Levels are only computed when first
+// asked for after a new frame, each directly from the source samples, so
+// they match resampleThermalImage at the same size. Regions at arbitrary
+// zoom factors are resampled on demand with cached plans.
+//
+// Not thread safe, use one instance per consumer thread.
+
+class ZoomPyramid
+{
+public:
+	explicit ZoomPyramid(int maxWidth = 2048, ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+
+	// samples: geometry.PixelCount() temperatures
+	void SetFrame(const float * samples, const SensorGeometry & geometry);
+
+	int LevelCount() const { return static_cast<int>(levels.size()); }
+	int LevelWidth(int level) const { return geometry.width << level; }
+	int LevelHeight(int level) const { return geometry.height << level; }
+
+	// The smallest level at least width pixels wide, or the largest one.
+	int LevelFor(int width) const;
+
+	// LevelWidth * LevelHeight temperatures, row by row.
+	const float * Level(int level);
+
+	// Output rectangle [col_begin, col_end) x [row_begin, row_end) of the
+	// frame scaled to zoom_width pixels wide, written row by row.
+	void Region(int zoom_width, int col_begin, int col_end, int row_begin, int row_end, float * output);
+
+	// Levels resampled for the current frame.
+	size_t ComputedLevels() const { return computed; }
+
+private:
+	struct LevelData
+	{
+		std::shared_ptr<const ResamplePlan> plan;
+		std::vector<float> values;
+		uint32_t stamp;
+	};
+
+	int maxWidth;
+	ResampleKernel kernel;
+	SensorGeometry geometry;
+	std::vector<float> samples;
+	std::vector<LevelData> levels;
+	std::vector<float> horizontal; // resample pass, shared by all levels
+	uint32_t frameStamp;
+	size_t computed;
+};
@@ -1,81 +1,225 @@
 #include "pch.h"
 #include "resample.h"
 
-static float sinc(const float x)
+static double sinc(const double x)
 {
 	return x == 0 ? 1 : (sin(x) / x);
 }
 
-static float normalized_sinc(const float x)
+static double normalized_sinc(const double x)
 {
 	return sinc(x * M_PI);
 }
 
-static float lanczos_weight(const float x)
+static double nearest_weight(const double x)
 {
-	static const int window_size = 3;
-	return std::abs(x) >= window_size ? 0 : (normalized_sinc(x) * normalized_sinc(x / window_size));
+	return std::abs(x) <= 0.5 ? 1 : 0;
 }
 
-static float cached_lanczos_weight(const float x, const float y)
+static double bilinear_weight(const double x)
 {
-	static std::map<std::pair<float, float>, float> cached_values;
-	const auto ret = cached_values.insert(std::make_pair(std::make_pair(x, y), 0.0f));
-	if (ret.second) {
-		ret.first->second = lanczos_weight(x) * lanczos_weight(y);
+	return std::max(0.0, 1 - std::abs(x));
+}
+
+static double bicubic_weight(double x)
+{
+	static const double a = -0.75;
+	x = std::abs(x);
+	if (x < 1) {
+		return ((a + 2) * x - (a + 3)) * x * x + 1;
 	}
+	if (x < 2) {
+		return ((a * x - 5 * a) * x + 8 * a) * x - 4 * a;
+	}
+	return 0;
+}
 
-	return ret.first->second;
+static double lanczos2_weight(const double x)
+{
+	return std::abs(x) >= 2 ? 0 : (normalized_sinc(x) * normalized_sinc(x / 2));
 }
 
+static double lanczos3_weight(const double x)
+{
+	return std::abs(x) >= 3 ? 0 : (normalized_sinc(x) * normalized_sinc(x / 3));
+}
 
-std::vector<float> resampleThermalImage(const std::vector<float>& input, const int scaled_size)
+static const ResampleKernelInfo kernels[] = {
+	{ ResampleKernel::Nearest, "nearest", 1, true, nearest_weight },
+	{ ResampleKernel::Bilinear, "bilinear", 2, true, bilinear_weight },
+	{ ResampleKernel::Bicubic, "bicubic", 4, true, bicubic_weight },
+	{ ResampleKernel::Lanczos2, "lanczos2", 4, true, lanczos2_weight },
+	{ ResampleKernel::Lanczos3, "lanczos3", 6, false, lanczos3_weight },
+	{ ResampleKernel::Lanczos3Clamped, "lanczos3-clamped", 6, true, lanczos3_weight },
+};
+
+static_assert(sizeof kernels / sizeof kernels[0] == static_cast<size_t>(ResampleKernel::Count), "kernel missing from the registry");
+
+const ResampleKernelInfo & resampleKernelInfo(const ResampleKernel kernel)
 {
-	// The input is expected to be 8x8 pixels
-	// It is scaled to scaled_size x scaled_size pixels
-	assert(input.size() == 8 * 8);
+	return kernels[static_cast<size_t>(kernel)];
+}
+
+ResamplePlan::ResamplePlan(const SensorGeometry & source, const int scaled_width, const int scaled_height, const ResampleKernel kernel) :
+	source(source), scaled_width(scaled_width), scaled_height(scaled_height), kernel(kernel),
+	tap_count(resampleKernelInfo(kernel).taps), columns(scaled_width), rows(scaled_height)
+{
+	for (int i = 0; i < scaled_width; ++i) {
+		columns[i] = ComputeTap(SourceCoordinate(i, source.width, scaled_width), source.width, kernel);
+	}
+	for (int i = 0; i < scaled_height; ++i) {
+		rows[i] = ComputeTap(SourceCoordinate(i, source.height, scaled_height), source.height, kernel);
+	}
+}
+
+ResamplePlan::ResamplePlan(const int scaled_size, const ResampleKernel kernel) :
+	ResamplePlan(amg88xx_geometry, scaled_size, scaled_size, kernel)
+{
+}
 
+float ResamplePlan::SourceCoordinate(const int i, const int source_size, const int scaled_size)
+{
 	// calculate float coordinates of this pixel in the original image's scale.
-	// Original image covers (-0.5 .. 7.5, with a sample point at each integer)
+	// Original image covers (-0.5 .. source_size - 0.5, with a sample point at each integer)
 	// Target image should cover the same area, with evenly placed sample points
-	const float scaled_pixel_size = 8.0f / scaled_size;
+	const float scaled_pixel_size = static_cast<float>(source_size) / scaled_size;
 	const float scaled_range_start = -0.5f + scaled_pixel_size / 2.0f;
+	return scaled_range_start + i * scaled_pixel_size;
+}
 
-	std::vector<float> output(scaled_size * scaled_size, 0.0f);
+ResamplePlan::Tap ResamplePlan::ComputeTap(const float f, const int source_size, const ResampleKernel kernel)
+{
+	// The window of n taps covers floor(f + 1 - n / 2) onwards, e.g.
+	// floor(f) - 2 .. floor(f) + 3 for Lanczos-3. Source pixels outside the
+	// image either repeat the edge pixel, or are left out.
+	const ResampleKernelInfo & info = resampleKernelInfo(kernel);
+	Tap tap;
+	const int first = static_cast<int>(floor(f + 1 - info.taps / 2.0));
+	double weights[taps];
+	double sum = 0;
+	for (int k = 0; k < taps; ++k) {
+		const int source = first + k;
+		const bool inside = source >= 0 && source < source_size;
+		tap.index[k] = source < 0 ? 0 : (source > source_size - 1 ? source_size - 1 : source);
+		weights[k] = k < info.taps && (inside || info.clampEdges) ? info.weight(f - source) : 0;
+		sum += weights[k];
+	}
+	for (int k = 0; k < taps; ++k) {
+		tap.weight[k] = static_cast<float>(weights[k] / sum);
+	}
+	return tap;
+}
+
+void ResamplePlan::Apply(const float * input, float * output, std::vector<float> & scratch) const
+{
+	ApplyRect(input, output, scratch, 0, scaled_width, 0, scaled_height);
+}
 
-	for (unsigned row = 0; row < scaled_size; ++row) {
-		const float f_row = scaled_range_start + row * scaled_pixel_size;
-		for (unsigned col = 0; col < scaled_size; ++col) {
-			const float f_col = scaled_range_start + col * scaled_pixel_size;
+void ResamplePlan::Apply(const float * input, float * output) const
+{
+	std::vector<float> scratch;
+	Apply(input, output, scratch);
+}
 
+void ResamplePlan::ApplyRect(const float * input, float * output, std::vector<float> & scratch,
+	const int col_begin, const int col_end, const int row_begin, const int row_end) const
+{
+	switch (tap_count) {
+	case 1: ApplyPasses<1>(input, output, scratch, col_begin, col_end, row_begin, row_end); break;
+	case 2: ApplyPasses<2>(input, output, scratch, col_begin, col_end, row_begin, row_end); break;
+	case 4: ApplyPasses<4>(input, output, scratch, col_begin, col_end, row_begin, row_end); break;
+	default: ApplyPasses<taps>(input, output, scratch, col_begin, col_end, row_begin, row_end); break;
+	}
+}
+
+template<int Taps>
+void ResamplePlan::ApplyPasses(const float * input, float * output, std::vector<float> & scratch,
+	const int col_begin, const int col_end, const int row_begin, const int row_end) const
+{
+	const int width = col_end - col_begin;
+
+	// only the source rows the requested output rows depend on
+	int source_begin = source.height;
+	int source_end = 0;
+	for (int row = row_begin; row < row_end; ++row) {
+		for (int k = 0; k < Taps; ++k) {
+			source_begin = std::min(source_begin, rows[row].index[k]);
+			source_end = std::max(source_end, rows[row].index[k] + 1);
+		}
+	}
+
+	if (source_begin >= source_end) {
+		return;
+	}
+
+	// horizontal pass: source rows resampled to the requested columns,
+	// row source_begin first
+	scratch.resize(static_cast<size_t>(source_end - source_begin) * width);
+	float * const h = scratch.data();
+
+	for (int source_row = source_begin; source_row < source_end; ++source_row) {
+		const float * in = input + source_row * source.width;
+		float * out = h + (source_row - source_begin) * width;
+		for (int col = col_begin; col < col_end; ++col) {
+			const Tap & t = columns[col];
 			float accumulator = 0;
-			float weight = 0;
-
-			const int first_effective_row = static_cast<int>(floor(f_row)) - 2;
-			const int last_effective_row = static_cast<int>(ceil(f_row)) + 2;
-			const int first_effective_col = static_cast<int>(floor(f_col)) - 2;
-			const int last_effective_col = static_cast<int>(ceil(f_col)) + 2;
-
-			for (int source_row = first_effective_row; source_row <= last_effective_row; ++source_row) {
-				const int effective_source_row = source_row < 0 ? 0 : (source_row > 7 ? 7 : source_row);
-				for (int source_col = first_effective_col; source_col <= last_effective_col; ++source_col) {
-					const int effective_source_col = source_col < 0 ? 0 : (source_col > 7 ? 7 : source_col);
-
-					const float source_value = input[effective_source_row * 8 + effective_source_col];
-					const float d_row = f_row - source_row;
-					const float d_col = f_col - source_col;
-					const float source_weight = cached_lanczos_weight(d_row, d_col);
-
-					accumulator += source_value * source_weight;
-					weight += source_weight;
-				}
+			for (int k = 0; k < Taps; ++k) {
+				accumulator += in[t.index[k]] * t.weight[k];
 			}
+			out[col - col_begin] = accumulator;
+		}
+	}
 
-			const float target_value = accumulator / weight;
-
-			output[row * scaled_size + col] = target_value;
+	// vertical pass
+	for (int row = row_begin; row < row_end; ++row) {
+		const Tap & t = rows[row];
+		float * out = output + (row - row_begin) * width;
+		for (int col = 0; col < width; ++col) {
+			out[col] = 0;
+		}
+		for (int k = 0; k < Taps; ++k) {
+			const float * in = h + (t.index[k] - source_begin) * width;
+			const float w = t.weight[k];
+			for (int col = 0; col < width; ++col) {
+				out[col] += in[col] * w;
+			}
 		}
 	}
+}
+
+std::shared_ptr<const ResamplePlan> getResamplePlan(const SensorGeometry & source, const int scaled_width, const int scaled_height,
+	const ResampleKernel kernel)
+{
+	static std::mutex lock;
+	static std::map<std::tuple<SensorGeometry, int, int, ResampleKernel>, std::shared_ptr<const ResamplePlan>> plans;
+
+	std::lock_guard<std::mutex> guard(lock);
+	auto & plan = plans[std::make_tuple(source, scaled_width, scaled_height, kernel)];
+	if (!plan) {
+		plan = std::make_shared<const ResamplePlan>(source, scaled_width, scaled_height, kernel);
+	}
+	return plan;
+}
+
+std::shared_ptr<const ResamplePlan> getResamplePlan(const int scaled_size, const ResampleKernel kernel)
+{
+	return getResamplePlan(amg88xx_geometry, scaled_size, scaled_size, kernel);
+}
+
+std::vector<float> resampleThermalImage(const std::vector<float> & input, const SensorGeometry & source,
+	const int scaled_width, const int scaled_height)
+{
+	assert(input.size() == static_cast<size_t>(source.PixelCount()));
+
+	std::vector<float> output(scaled_width * scaled_height, 0.0f);
+	getResamplePlan(source, scaled_width, scaled_height)->Apply(input.data(), output.data());
 
 	return output;
 }
+
+std::vector<float> resampleThermalImage(const std::vector<float>& input, const int scaled_size)
+{
+	// The input is expected to be 8x8 pixels
+	// It is scaled to scaled_size x scaled_size pixels
+	return resampleThermalImage(input, amg88xx_geometry, scaled_size, scaled_size);
+}
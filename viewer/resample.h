@@ -1,5 +1,107 @@
 #pragma once
 
+#include <memory>
 #include <vector>
+#include "geometry.h"
 
-std::vector<float> resampleThermalImage(const std::vector<float> & input, int scaled_size);
\ No newline at end of file
+// Interpolation kernels the sensor image can be resampled with. The
+// front ends used to differ: Lanczos3Clamped is what this viewer always
+// used, Lanczos3 matches the iOS Metal scaler, Bicubic OpenCV's
+// INTER_CUBIC.
+enum class ResampleKernel
+{
+	Nearest,
+	Bilinear,
+	Bicubic,         // Keys cubic convolution, a = -0.75
+	Lanczos2,
+	Lanczos3,        // taps outside the image are dropped, the rest renormalized
+	Lanczos3Clamped, // taps outside the image repeat the edge pixel
+	Count,
+};
+
+struct ResampleKernelInfo
+{
+	ResampleKernel kernel;
+	const char * name;
+	int taps;                   // source pixels per output pixel and axis
+	bool clampEdges;
+	double (*weight)(double x); // x: distance from the output pixel, in source pixels
+};
+
+const ResampleKernelInfo & resampleKernelInfo(ResampleKernel kernel);
+
+// Precomputed weights to resample a sensor image to
+// scaled_width x scaled_height pixels with one of the kernels above.
+//
+// The kernels are separable, so weights are stored per axis: each output
+// column (and row) has its contributing source columns (rows) with
+// normalized weights. Applying the plan is a horizontal pass over the
+// source rows followed by a vertical pass, so the cost per output pixel is
+// the kernel's taps times (1 + source height / scaled height), whatever
+// the size of the sensor. The passes are specialized per tap count.
+class ResamplePlan
+{
+public:
+	static const int taps = 6; // of the widest kernel
+
+	struct Tap
+	{
+		int index[taps];    // source pixel, already clamped to the image
+		float weight[taps]; // normalized, sums to 1. Zero beyond the kernel's tap count
+	};
+
+	ResamplePlan(const SensorGeometry & source, int scaled_width, int scaled_height,
+		ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+
+	// Square image of the 8x8 sensor.
+	explicit ResamplePlan(int scaled_size, ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+
+	const SensorGeometry & Source() const { return source; }
+	int ScaledWidth() const { return scaled_width; }
+	int ScaledHeight() const { return scaled_height; }
+	ResampleKernel Kernel() const { return kernel; }
+	int TapCount() const { return tap_count; }
+	const Tap & ColumnTap(int col) const { return columns[col]; }
+	const Tap & RowTap(int row) const { return rows[row]; }
+
+	// Maps an output pixel index to the source coordinate of its center,
+	// along an axis of source_size pixels scaled to scaled_size.
+	static float SourceCoordinate(int i, int source_size, int scaled_size);
+
+	// Weights for an arbitrary source coordinate.
+	static Tap ComputeTap(float f, int source_size, ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+
+	// input: source width * height samples,
+	// output: scaled_width * scaled_height samples.
+	// scratch holds the horizontal pass, (source rows used) * (output
+	// columns) samples. It is resized as needed, so a caller that keeps it
+	// between frames does not allocate once it has grown.
+	void Apply(const float * input, float * output, std::vector<float> & scratch) const;
+	void Apply(const float * input, float * output) const;
+
+	// Resamples only the output rectangle [col_begin, col_end) x [row_begin, row_end),
+	// written row by row to output.
+	void ApplyRect(const float * input, float * output, std::vector<float> & scratch,
+		int col_begin, int col_end, int row_begin, int row_end) const;
+
+private:
+	template<int Taps>
+	void ApplyPasses(const float * input, float * output, std::vector<float> & scratch,
+		int col_begin, int col_end, int row_begin, int row_end) const;
+
+	SensorGeometry source;
+	int scaled_width;
+	int scaled_height;
+	ResampleKernel kernel;
+	int tap_count;
+	std::vector<Tap> columns;
+	std::vector<Tap> rows;
+};
+
+// Plans are immutable, and shared between all users of the same sizes and kernel.
+std::shared_ptr<const ResamplePlan> getResamplePlan(const SensorGeometry & source, int scaled_width, int scaled_height,
+	ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+std::shared_ptr<const ResamplePlan> getResamplePlan(int scaled_size, ResampleKernel kernel = ResampleKernel::Lanczos3Clamped);
+
+std::vector<float> resampleThermalImage(const std::vector<float> & input, const SensorGeometry & source, int scaled_width, int scaled_height);
+std::vector<float> resampleThermalImage(const std::vector<float> & input, int scaled_size);
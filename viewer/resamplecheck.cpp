@@ -0,0 +1,152 @@
+#include "pch.h"
+#include "resamplecheck.h"
+#include "fixedpoint.h"
+
+static const int golden_size = 24;
+static const int golden_points[][2] = { { 0, 0 }, { 5, 7 }, { 12, 12 }, { 23, 0 }, { 17, 9 }, { 23, 23 } };
+static const size_t golden_count = sizeof golden_points / sizeof golden_points[0];
+static const double golden_tolerance = 1e-3;
+
+// test frame outputs at golden_points, golden_size x golden_size
+static const float golden_values[][golden_count] = {
+	/* nearest */          { 20.0000f, 21.2500f, 23.0000f, 21.7500f, 28.7500f, 25.2500f },
+	/* bilinear */         { 20.0000f, 21.3333f, 22.7500f, 21.7500f, 28.0000f, 25.2500f },
+	/* bicubic */          { 19.9167f, 21.3426f, 22.5494f, 21.7222f, 30.0010f, 25.3333f },
+	/* lanczos2 */         { 19.9368f, 21.3398f, 22.5918f, 21.7289f, 29.4433f, 25.3132f },
+	/* lanczos3 */         { 19.9098f, 21.3479f, 22.5889f, 21.7439f, 30.4704f, 25.3402f },
+	/* lanczos3-clamped */ { 19.9370f, 21.3371f, 22.5889f, 21.7407f, 30.3766f, 25.3130f },
+};
+
+static_assert(sizeof golden_values / sizeof golden_values[0] == static_cast<size_t>(ResampleKernel::Count), "golden values missing");
+
+// gradient of room temperatures, with a warm and a cold spot
+static std::vector<float> testFrame()
+{
+	const int n = amg88xx_geometry.width;
+	std::vector<float> frame(n * n);
+	for (int row = 0; row < n; ++row) {
+		for (int col = 0; col < n; ++col) {
+			frame[row * n + col] = 20.0f + 0.25f * col + 0.5f * row;
+		}
+	}
+	frame[2 * n + 5] += 12.0f;
+	frame[3 * n + 5] += 6.0f;
+	frame[6 * n + 1] -= 5.0f;
+	return frame;
+}
+
+static void referenceAxis(const double f, const ResampleKernelInfo & info, int * index, double * weight)
+{
+	const int n = amg88xx_geometry.width;
+	const int first = static_cast<int>(floor(f + 1 - info.taps / 2.0));
+	double sum = 0;
+	for (int k = 0; k < info.taps; ++k) {
+		const int source = first + k;
+		const bool inside = source >= 0 && source < n;
+		index[k] = std::min(std::max(source, 0), n - 1);
+		weight[k] = inside || info.clampEdges ? info.weight(f - source) : 0;
+		sum += weight[k];
+	}
+	for (int k = 0; k < info.taps; ++k) {
+		weight[k] /= sum;
+	}
+}
+
+// direct 2D evaluation in double precision, independent of the plans
+static std::vector<double> referenceResample(const std::vector<float> & input, const int scaled_size, const ResampleKernel kernel)
+{
+	const int n = amg88xx_geometry.width;
+	const ResampleKernelInfo & info = resampleKernelInfo(kernel);
+	const double pixel = static_cast<double>(n) / scaled_size;
+
+	std::vector<int> index(scaled_size * info.taps);
+	std::vector<double> weight(scaled_size * info.taps);
+	for (int i = 0; i < scaled_size; ++i) {
+		referenceAxis(-0.5 + pixel / 2 + i * pixel, info, &index[i * info.taps], &weight[i * info.taps]);
+	}
+
+	std::vector<double> output(scaled_size * scaled_size);
+	for (int row = 0; row < scaled_size; ++row) {
+		for (int col = 0; col < scaled_size; ++col) {
+			double sum = 0;
+			for (int j = 0; j < info.taps; ++j) {
+				for (int i = 0; i < info.taps; ++i) {
+					sum += weight[row * info.taps + j] * weight[col * info.taps + i] *
+						input[index[row * info.taps + j] * n + index[col * info.taps + i]];
+				}
+			}
+			output[row * scaled_size + col] = sum;
+		}
+	}
+	return output;
+}
+
+std::vector<ResampleKernelReport> runResampleHarness(const int scaled_size, const int iterations)
+{
+	const std::vector<float> frame = testFrame();
+	const std::vector<double> quality = referenceResample(frame, scaled_size, ResampleKernel::Lanczos3Clamped);
+
+	std::vector<ResampleKernelReport> reports;
+	for (size_t k = 0; k < static_cast<size_t>(ResampleKernel::Count); ++k) {
+		const ResampleKernel kernel = static_cast<ResampleKernel>(k);
+		ResampleKernelReport report = { kernel, resampleKernelInfo(kernel).name, true, 0, 0, 0, 0, 0, 0 };
+
+		std::vector<float> golden(golden_size * golden_size);
+		getResamplePlan(golden_size, kernel)->Apply(frame.data(), golden.data());
+		for (size_t i = 0; i < golden_count; ++i) {
+			const float value = golden[golden_points[i][1] * golden_size + golden_points[i][0]];
+			if (std::abs(value - golden_values[k][i]) > golden_tolerance) {
+				report.goldenMatch = false;
+			}
+		}
+
+		const auto plan = getResamplePlan(scaled_size, kernel);
+		std::vector<float> output(scaled_size * scaled_size);
+		std::vector<float> horizontal;
+		const auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			plan->Apply(frame.data(), output.data(), horizontal);
+		}
+		report.nsPerFrame = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+		const std::vector<double> reference = referenceResample(frame, scaled_size, kernel);
+		double squares = 0;
+		for (size_t i = 0; i < output.size(); ++i) {
+			report.precisionError = std::max(report.precisionError, std::abs(output[i] - reference[i]));
+			const double error = output[i] - quality[i];
+			report.maxError = std::max(report.maxError, std::abs(error));
+			squares += error * error;
+		}
+		report.rmsError = sqrt(squares / output.size());
+
+		const auto fixedPlan = getFixedResamplePlan(amg88xx_geometry, scaled_size, scaled_size, kernel);
+		std::vector<FixedTemperature> fixedFrame(frame.size());
+		std::vector<FixedTemperature> fixedOutput(output.size());
+		std::vector<FixedTemperature> fixedHorizontal;
+		toFixedTemperatures(frame.data(), fixedFrame.data(), frame.size());
+		const auto fixedStart = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; ++i) {
+			fixedPlan->Apply(fixedFrame.data(), fixedOutput.data(), fixedHorizontal);
+		}
+		report.fixedNsPerFrame = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - fixedStart).count() / iterations;
+		for (size_t i = 0; i < output.size(); ++i) {
+			report.fixedPointError = std::max(report.fixedPointError, static_cast<double>(std::abs(fromFixedTemperature(fixedOutput[i]) - output[i])));
+		}
+
+		reports.push_back(report);
+	}
+	return reports;
+}
+
+std::string formatResampleReport(const std::vector<ResampleKernelReport> & reports)
+{
+	std::ostringstream out;
+	out.precision(3);
+	for (const auto & r : reports) {
+		out << r.name << ": golden " << (r.goldenMatch ? "ok" : "MISMATCH") <<
+			", precision " << r.precisionError << ", max error " << r.maxError << ", rms " << r.rmsError <<
+			" degC, " << std::fixed << r.nsPerFrame << std::defaultfloat << " ns/frame, fixed point error " << r.fixedPointError <<
+			" degC, " << std::fixed << r.fixedNsPerFrame << std::defaultfloat << " ns/frame\n";
+	}
+	return out.str();
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "resample.h"
+
+// Accuracy and speed of the resampling kernels, to pick the cheapest one
+// that meets the accuracy needed by a deployment.
+//
+// Every kernel resamples a fixed test frame. The result is checked against
+// pinned golden values, so a kernel can't change silently, and compared
+// with double precision references: the same kernel (errors of the float
+// implementation) and the clamped Lanczos-3 kernel (quality loss against
+// what the viewer renders by default). The fixed point version of each
+// plan is compared with the float one.
+
+struct ResampleKernelReport
+{
+	ResampleKernel kernel;
+	const char * name;
+	bool goldenMatch;
+	double precisionError; // max abs, degC, against the kernel in double precision
+	double maxError;       // max abs, degC, against Lanczos-3 clamped in double precision
+	double rmsError;
+	double nsPerFrame;
+	double fixedPointError;   // max abs, degC, of the Q8.8 plan against the float one
+	double fixedNsPerFrame;
+};
+
+std::vector<ResampleKernelReport> runResampleHarness(int scaled_size = 100, int iterations = 200);
+
+// One line per kernel.
+std::string formatResampleReport(const std::vector<ResampleKernelReport> & reports);
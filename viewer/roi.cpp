@@ -0,0 +1,135 @@
+#include "pch.h"
+#include "roi.h"
+#include "resample.h"
+
+float RoiResult::Percentile(const float p) const
+{
+	if (sorted.empty()) {
+		return 0;
+	}
+	const float clamped = p < 0 ? 0 : (p > 100 ? 100 : p);
+	const size_t rank = static_cast<size_t>(ceil(clamped / 100 * sorted.size()));
+	return sorted[rank == 0 ? 0 : rank - 1];
+}
+
+RoiQuery::RoiQuery(const int resolution, const SensorGeometry & geometry) : resolution(resolution), geometry(geometry),
+	plan(getResamplePlan(geometry, resolution, resolution)), samples(geometry.PixelCount(), 0.0f)
+{
+}
+
+void RoiQuery::SetFrame(const std::vector<float> & newSamples)
+{
+	assert(newSamples.size() == samples.size());
+	samples = newSamples;
+	cache.clear();
+}
+
+float RoiQuery::PointTemperature(const float x, const float y) const
+{
+	const ResamplePlan::Tap tx = ResamplePlan::ComputeTap(x * geometry.width - 0.5f, geometry.width);
+	const ResamplePlan::Tap ty = ResamplePlan::ComputeTap(y * geometry.height - 0.5f, geometry.height);
+
+	float accumulator = 0;
+	for (int j = 0; j < ResamplePlan::taps; ++j) {
+		const float * row = samples.data() + ty.index[j] * geometry.width;
+		float row_accumulator = 0;
+		for (int i = 0; i < ResamplePlan::taps; ++i) {
+			row_accumulator += row[tx.index[i]] * tx.weight[i];
+		}
+		accumulator += row_accumulator * ty.weight[j];
+	}
+	return accumulator;
+}
+
+const RoiResult & RoiQuery::Rect(const float left, const float top, const float right, const float bottom)
+{
+	const std::vector<float> key = { left, top, right, bottom };
+	return Evaluate(key, nullptr, left, top, right, bottom);
+}
+
+const RoiResult & RoiQuery::Polygon(const std::vector<RoiPoint> & points)
+{
+	std::vector<float> key;
+	key.reserve(points.size() * 2 + 1);
+	key.push_back(-1); // keeps polygon keys apart from rectangle keys
+	float left = 1, top = 1, right = 0, bottom = 0;
+	for (const auto & p : points) {
+		key.push_back(p.x);
+		key.push_back(p.y);
+		left = std::min(left, p.x);
+		right = std::max(right, p.x);
+		top = std::min(top, p.y);
+		bottom = std::max(bottom, p.y);
+	}
+	return Evaluate(key, &points, left, top, right, bottom);
+}
+
+static bool insidePolygon(const std::vector<RoiPoint> & polygon, const float x, const float y)
+{
+	// even-odd rule
+	bool inside = false;
+	for (size_t i = 0, j = polygon.size() - 1; i < polygon.size(); j = i++) {
+		const RoiPoint & a = polygon[i];
+		const RoiPoint & b = polygon[j];
+		if ((a.y > y) != (b.y > y) && x < (b.x - a.x) * (y - a.y) / (b.y - a.y) + a.x) {
+			inside = !inside;
+		}
+	}
+	return inside;
+}
+
+const RoiResult & RoiQuery::Evaluate(const std::vector<float> & key, const std::vector<RoiPoint> * polygon,
+	const float left, const float top, const float right, const float bottom)
+{
+	const auto cached = cache.find(key);
+	if (cached != cache.end()) {
+		return cached->second;
+	}
+
+	RoiResult & result = cache[key];
+
+	// pixel i covers [i, i + 1) / resolution, it is part of the region if its center is
+	const auto first = [this](const float v) { return std::max(0, static_cast<int>(ceil(v * resolution - 0.5f))); };
+	const auto last = [this](const float v) { return std::min(resolution, static_cast<int>(floor(v * resolution - 0.5f)) + 1); };
+	const int col_begin = first(left);
+	const int col_end = last(right);
+	const int row_begin = first(top);
+	const int row_end = last(bottom);
+	if (col_begin >= col_end || row_begin >= row_end) {
+		return result;
+	}
+
+	const int width = col_end - col_begin;
+	scratch.resize(width * (row_end - row_begin));
+	plan->ApplyRect(samples.data(), scratch.data(), horizontal, col_begin, col_end, row_begin, row_end);
+
+	if (polygon) {
+		result.sorted.reserve(scratch.size());
+		for (int row = row_begin; row < row_end; ++row) {
+			const float y = (row + 0.5f) / resolution;
+			for (int col = col_begin; col < col_end; ++col) {
+				if (insidePolygon(*polygon, (col + 0.5f) / resolution, y)) {
+					result.sorted.push_back(scratch[(row - row_begin) * width + col - col_begin]);
+				}
+			}
+		}
+	}
+	else {
+		result.sorted = scratch;
+	}
+
+	if (result.sorted.empty()) {
+		return result;
+	}
+
+	std::sort(result.sorted.begin(), result.sorted.end());
+	double sum = 0;
+	for (const float v : result.sorted) {
+		sum += v;
+	}
+	result.count = result.sorted.size();
+	result.min = result.sorted.front();
+	result.max = result.sorted.back();
+	result.mean = static_cast<float>(sum / result.count);
+	return result;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <vector>
+#include "geometry.h"
+
+class ResamplePlan;
+
+// Temperature queries on the interpolated field of a frame, without
+// rendering it. Values are evaluated with the same kernel and plan tables
+// as resampleThermalImage, only where the query needs them.
+//
+// Coordinates are normalized to the sensor's field of view: (0, 0) is the
+// top left corner of the image, (1, 1) the bottom right one. Area
+// statistics are taken over the pixels of the image rendered at the
+// configured resolution whose centers fall into the region.
+//
+// Area results are cached until the next frame. Not thread safe, use one
+// instance per consumer thread.
+
+struct RoiPoint
+{
+	float x;
+	float y;
+};
+
+struct RoiResult
+{
+	size_t count = 0;
+	float min = 0;
+	float max = 0;
+	float mean = 0;
+
+	// p in 0..100, nearest rank on the evaluated pixels
+	float Percentile(float p) const;
+
+private:
+	friend class RoiQuery;
+	std::vector<float> sorted;
+};
+
+class RoiQuery
+{
+public:
+	explicit RoiQuery(int resolution = 100, const SensorGeometry & geometry = amg88xx_geometry);
+
+	int Resolution() const { return resolution; }
+
+	// Takes the decoded source samples of a new frame.
+	void SetFrame(const std::vector<float> & samples);
+
+	float PointTemperature(float x, float y) const;
+	const RoiResult & Rect(float left, float top, float right, float bottom);
+	const RoiResult & Polygon(const std::vector<RoiPoint> & points);
+
+private:
+	const RoiResult & Evaluate(const std::vector<float> & key, const std::vector<RoiPoint> * polygon,
+		float left, float top, float right, float bottom);
+
+	int resolution;
+	SensorGeometry geometry;
+	std::shared_ptr<const ResamplePlan> plan;
+	std::vector<float> samples;
+	std::vector<float> scratch;
+	std::vector<float> horizontal; // resample pass
+	std::map<std::vector<float>, RoiResult> cache;
+};
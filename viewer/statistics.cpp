@@ -0,0 +1,230 @@
+#include "pch.h"
+#include "statistics.h"
+
+size_t StatisticsParams::MemoryUsage(const int pixelCount) const
+{
+	size_t buckets = 0;
+	for (int i = 0; i < static_cast<int>(StatisticsWindow::Count); ++i) {
+		buckets += static_cast<size_t>(ceil(windowSeconds[i] / bucketSeconds[i])) + 1;
+	}
+	return buckets * 2 * 4 * sizeof(float) * pixelCount;
+}
+
+StatisticsParams StatisticsParams::ForMemoryLimit(const int pixelCount, const size_t memoryLimit)
+{
+	const StatisticsParams defaults;
+	const int maxFactor = static_cast<int>(defaults.windowSeconds[0] / defaults.bucketSeconds[0]) / 2;
+	StatisticsParams params;
+	for (int factor = 2; factor <= maxFactor && params.MemoryUsage(pixelCount) > memoryLimit; ++factor) {
+		for (int i = 0; i < static_cast<int>(StatisticsWindow::Count); ++i) {
+			params.bucketSeconds[i] = defaults.bucketSeconds[i] * factor;
+		}
+	}
+	return params;
+}
+
+PixelStatistics::PixelStatistics(const int pixelCount, const StatisticsParams & params) : params(params), pixelCount(pixelCount)
+{
+	Reset(pixelCount);
+}
+
+void PixelStatistics::Reset()
+{
+	Reset(pixelCount);
+}
+
+void PixelStatistics::Reset(const int newPixelCount)
+{
+	pixelCount = newPixelCount;
+	const size_t block = static_cast<size_t>(pixelCount) * 4;
+
+	levels.resize(static_cast<int>(StatisticsWindow::Count));
+	for (size_t i = 0; i < levels.size(); ++i) {
+		Level & level = levels[i];
+		level.open.values.assign(block, 0.0f);
+		level.open.count = 0;
+		level.openStart = 0;
+
+		Queue & queue = level.queue;
+		queue.capacity = static_cast<size_t>(ceil(params.windowSeconds[i] / params.bucketSeconds[i])) + 1;
+		queue.elements.assign(queue.capacity * block, 0.0f);
+		queue.suffixes.assign(queue.capacity * block, 0.0f);
+		queue.elementCounts.assign(queue.capacity, 0);
+		queue.suffixCounts.assign(queue.capacity, 0);
+		queue.starts.assign(queue.capacity, 0);
+		queue.back.values.assign(block, 0.0f);
+		queue.back.count = 0;
+		queue.head = queue.boundary = queue.tail = 0;
+	}
+}
+
+// Chan et al.'s pairwise update for the mean and m2. The weights are the
+// same for all pixels, which leaves a plain loop per statistic.
+void PixelStatistics::Combine(const float * a, const double countA, const float * b, const double countB, float * output) const
+{
+	const size_t block = static_cast<size_t>(pixelCount) * 4;
+	if (countB == 0) {
+		if (output != a) {
+			std::copy(a, a + block, output);
+		}
+		return;
+	}
+	if (countA == 0) {
+		if (output != b) {
+			std::copy(b, b + block, output);
+		}
+		return;
+	}
+
+	const int n = pixelCount;
+	const double count = countA + countB;
+	const float weightB = static_cast<float>(countB / count);
+	const float weightM2 = static_cast<float>(countA * countB / count);
+	for (int i = 0; i < n; ++i) {
+		output[i] = std::min(a[i], b[i]);
+	}
+	for (int i = n; i < 2 * n; ++i) {
+		output[i] = std::max(a[i], b[i]);
+	}
+	for (int i = 2 * n; i < 3 * n; ++i) {
+		const float delta = b[i] - a[i];
+		output[i + n] = a[i + n] + b[i + n] + delta * delta * weightM2;
+		output[i] = a[i] + delta * weightB;
+	}
+}
+
+void PixelStatistics::Push(Queue & queue, const Aggregate & bucket, const double start)
+{
+	if (queue.tail - queue.head == queue.capacity) {
+		Pop(queue);
+	}
+	const size_t slot = queue.tail % queue.capacity;
+	std::copy(bucket.values.begin(), bucket.values.end(), Stat(queue.elements, slot, 0));
+	queue.elementCounts[slot] = bucket.count;
+	queue.starts[slot] = start;
+	queue.tail++;
+
+	Combine(queue.back.values.data(), queue.back.count, bucket.values.data(), bucket.count, queue.back.values.data());
+	queue.back.count += bucket.count;
+}
+
+void PixelStatistics::Pop(Queue & queue)
+{
+	if (queue.head == queue.boundary) {
+		// turn the back stack over, each element gets the aggregate of
+		// itself and all newer ones
+		for (size_t i = queue.tail; i-- > queue.head;) {
+			const size_t slot = i % queue.capacity;
+			if (i == queue.tail - 1) {
+				std::copy(Stat(queue.elements, slot, 0), Stat(queue.elements, slot, 4), Stat(queue.suffixes, slot, 0));
+				queue.suffixCounts[slot] = queue.elementCounts[slot];
+			}
+			else {
+				const size_t next = (i + 1) % queue.capacity;
+				Combine(Stat(queue.elements, slot, 0), queue.elementCounts[slot],
+					Stat(queue.suffixes, next, 0), queue.suffixCounts[next], Stat(queue.suffixes, slot, 0));
+				queue.suffixCounts[slot] = queue.elementCounts[slot] + queue.suffixCounts[next];
+			}
+		}
+		queue.boundary = queue.tail;
+		queue.back.count = 0;
+	}
+	queue.head++;
+}
+
+void PixelStatistics::Add(const float * samples, const double timestamp)
+{
+	const int n = pixelCount;
+
+	// close the buckets which ended, shortest first so each one is rolled
+	// up before the longer one is checked
+	for (size_t i = 0; i < levels.size(); ++i) {
+		Level & level = levels[i];
+		if (level.open.count == 0 || timestamp < level.openStart + params.bucketSeconds[i]) {
+			continue;
+		}
+		Push(level.queue, level.open, level.openStart);
+		if (i + 1 < levels.size()) {
+			Level & up = levels[i + 1];
+			if (up.open.count == 0) {
+				up.openStart = floor(level.openStart / params.bucketSeconds[i + 1]) * params.bucketSeconds[i + 1];
+			}
+			Combine(up.open.values.data(), up.open.count, level.open.values.data(), level.open.count, up.open.values.data());
+			up.open.count += level.open.count;
+		}
+		level.open.count = 0;
+	}
+
+	Level & first = levels.front();
+	float * values = first.open.values.data();
+	if (first.open.count == 0) {
+		first.openStart = floor(timestamp / params.bucketSeconds[0]) * params.bucketSeconds[0];
+		std::copy(samples, samples + n, values);
+		std::copy(samples, samples + n, values + n);
+		std::copy(samples, samples + n, values + 2 * n);
+		std::fill(values + 3 * n, values + 4 * n, 0.0f);
+	}
+	else {
+		// Welford's update, a frame being an aggregate of one
+		const float weight = static_cast<float>(1 / (first.open.count + 1));
+		for (int i = 0; i < n; ++i) {
+			values[i] = std::min(values[i], samples[i]);
+			values[n + i] = std::max(values[n + i], samples[i]);
+			const float delta = samples[i] - values[2 * n + i];
+			values[2 * n + i] += delta * weight;
+			values[3 * n + i] += delta * (samples[i] - values[2 * n + i]);
+		}
+	}
+	first.open.count++;
+
+	// drop the buckets which ended before the window
+	for (size_t i = 0; i < levels.size(); ++i) {
+		Queue & queue = levels[i].queue;
+		while (queue.head != queue.tail &&
+			queue.starts[queue.head % queue.capacity] + params.bucketSeconds[i] <= timestamp - params.windowSeconds[i]) {
+			Pop(queue);
+		}
+	}
+}
+
+double PixelStatistics::Query(const StatisticsWindow window, const PixelStatistic statistic, float * output) const
+{
+	const int index = static_cast<int>(window);
+	const Queue & queue = levels[index].queue;
+
+	// closed buckets, then the open ones of this and the shorter windows,
+	// which are not rolled up yet
+	Aggregate result = queue.back;
+	if (queue.head != queue.boundary) {
+		const size_t slot = queue.head % queue.capacity;
+		Combine(Stat(queue.suffixes, slot, 0), queue.suffixCounts[slot], result.values.data(), result.count, result.values.data());
+		result.count += queue.suffixCounts[slot];
+	}
+	for (int i = index; i >= 0; --i) {
+		const Aggregate & open = levels[i].open;
+		Combine(result.values.data(), result.count, open.values.data(), open.count, result.values.data());
+		result.count += open.count;
+	}
+	if (result.count == 0) {
+		return 0;
+	}
+
+	const int n = pixelCount;
+	switch (statistic) {
+	case PixelStatistic::Min:
+		std::copy(result.values.begin(), result.values.begin() + n, output);
+		break;
+	case PixelStatistic::Max:
+		std::copy(result.values.begin() + n, result.values.begin() + 2 * n, output);
+		break;
+	case PixelStatistic::Mean:
+		std::copy(result.values.begin() + 2 * n, result.values.begin() + 3 * n, output);
+		break;
+	case PixelStatistic::Variance:
+		for (int i = 0; i < n; ++i) {
+			output[i] = static_cast<float>(result.values[3 * n + i] / result.count);
+		}
+		break;
+	}
+	return result.count;
+}
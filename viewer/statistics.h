@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+
+// Per pixel minimum, maximum, mean and variance of the source samples over
+// sliding windows of a minute, an hour and a day, for trend views.
+//
+// Frames are aggregated into buckets (by default a second for the minute
+// window, 30 s for the hour and 10 min for the day), each closed bucket
+// being rolled up into the next longer one. Every window is a queue of
+// closed buckets, aggregated with two stacks: pushing a bucket merges it
+// into a running aggregate of the back stack, and when the front stack
+// runs empty the back one is turned over into suffix aggregates, so both
+// push and pop cost O(1) amortized per pixel. The queue also holds the
+// combinations, so no inverse (subtracting an expired bucket) is needed
+// and min/max work the same way as the sums.
+//
+// All pixels share the same buckets, so everything is stored as arrays of
+// pixels (minimum of all pixels, then maximum, ...) and every operation is
+// a loop over pixels the compiler can vectorize. Windows are only as
+// precise as their bucket size.
+
+enum class StatisticsWindow
+{
+	Minute,
+	Hour,
+	Day,
+	Count,
+};
+
+enum class PixelStatistic
+{
+	Min,
+	Max,      // max-hold
+	Mean,
+	Variance,
+};
+
+struct StatisticsParams
+{
+	// per StatisticsWindow, each bucket size a multiple of the previous one
+	double windowSeconds[static_cast<int>(StatisticsWindow::Count)] = { 60, 3600, 86400 };
+	double bucketSeconds[static_cast<int>(StatisticsWindow::Count)] = { 1, 30, 600 };
+
+	// Bytes of the bucket queues: window / bucket + 1 buckets per window,
+	// each holding the four statistics of every pixel twice (element and
+	// suffix aggregate). The defaults take 327 * 2 * 4 floats per pixel,
+	// about 10 kB: 670 kB for an 8x8 sensor, 52 MB for 80x62.
+	size_t MemoryUsage(int pixelCount) const;
+
+	// The default windows, with all bucket sizes scaled by the smallest
+	// integer factor that fits pixelCount pixels into memoryLimit bytes, or
+	// by the largest one that leaves the minute window more than a bucket.
+	static StatisticsParams ForMemoryLimit(int pixelCount, size_t memoryLimit);
+};
+
+class PixelStatistics
+{
+public:
+	explicit PixelStatistics(int pixelCount = 64, const StatisticsParams & params = StatisticsParams());
+
+	void Reset();
+	void Reset(int pixelCount);
+
+	// timestamp in seconds, not decreasing
+	void Add(const float * samples, double timestamp);
+
+	// Writes pixelCount values of the statistic over the window, as of the
+	// last frame added. Returns the number of frames aggregated, output is
+	// left alone if it is 0.
+	double Query(StatisticsWindow window, PixelStatistic statistic, float * output) const;
+
+private:
+	// min, max, mean and m2 (sum of squared deviations from the mean) of
+	// all pixels, over count frames
+	struct Aggregate
+	{
+		std::vector<float> values;
+		double count;
+	};
+
+	// two stack sliding aggregate of up to capacity buckets
+	struct Queue
+	{
+		std::vector<float> elements; // capacity buckets
+		std::vector<float> suffixes; // aggregate of each front stack element and the ones after it
+		std::vector<double> elementCounts;
+		std::vector<double> suffixCounts;
+		std::vector<double> starts;
+		Aggregate back;
+		size_t capacity;
+		size_t head;     // oldest bucket, counters are taken modulo capacity
+		size_t boundary; // first bucket of the back stack
+		size_t tail;     // one past the newest bucket
+	};
+
+	struct Level
+	{
+		Aggregate open; // bucket being filled
+		double openStart;
+		Queue queue;
+	};
+
+	float * Stat(std::vector<float> & values, size_t slot, int stat) { return values.data() + (slot * 4 + stat) * pixelCount; }
+	const float * Stat(const std::vector<float> & values, size_t slot, int stat) const { return values.data() + (slot * 4 + stat) * pixelCount; }
+	void Combine(const float * a, double countA, const float * b, double countB, float * output) const;
+	void Push(Queue & queue, const Aggregate & bucket, double start);
+	void Pop(Queue & queue);
+
+	StatisticsParams params;
+	int pixelCount;
+	std::vector<Level> levels;
+};